@@ -0,0 +1,175 @@
+#include <math.h>
+#include <algorithm>
+#include "arcfit.hpp"
+
+#define ARC_MIN_POINTS 4
+#define ARC_MAX_POINTS 64
+#define ARC_MAX_MISSES 8
+#define ARC_MAX_RADIUS 1e4
+#define ARC_MAX_SWEEP (2.0 * M_PI - 1e-3)
+
+using namespace std;
+
+/*
+*
+*	An ArcFitter replaces runs of polyline vertices that lie on a circle with single arcs, so
+*	that a curved wall traced as many short segments becomes a few arc moves. Arcs are grown
+*	greedily from each vertex, one vertex at a time, up to ARC_MAX_POINTS vertices, and the
+*	longest one that fits is kept. Growing stops early after ARC_MAX_MISSES vertices in a row
+*	that don't fit (a few are expected while the arc is short and the traced staircase
+*	dominates). The circle is refitted from running sums in constant time as each vertex is
+*	added, but every vertex so far is checked against it again, so growing an arc of m vertices
+*	takes about m^2 / 2 checks. The next arc starts where the last one ends, which bounds that
+*	to about ARC_MAX_POINTS / 2 checks per vertex
+*
+*/
+ArcFitter::ArcFitter(double _tolerance) {
+	tolerance = _tolerance;
+}
+
+/*
+*
+*	Splits run (a polyline, in print order) into moves, each ending at a vertex of run: either
+*	an arc through every vertex it replaces or a line to the next vertex. Consecutive vertices
+*	must differ
+*
+*/
+void ArcFitter::fit(const vector<vertex<int> > *run, vector<arc_move> *moves) {
+
+	moves->clear();
+	int n = (int) run->size();
+	int i = 0;
+
+	while (i < n - 1) {
+
+		arc_move best;
+		best.end = -1;
+		sum_xx = sum_yy = sum_xy = sum_zx = sum_zy = 0;
+		int max_last = min(n - 1, i + ARC_MAX_POINTS - 1);
+		int misses = 0;
+		for (int j = i + 1; j <= max_last && misses < ARC_MAX_MISSES; j++) {
+			add_point(&(*run)[i], &(*run)[j]);
+			if (j < i + ARC_MIN_POINTS - 1) continue;
+			arc_move arc;
+			if (fit_arc(run, i, j, &arc)) {
+				best = arc;
+				misses = 0;
+			} else {
+				misses++;
+			}
+		}
+
+		if (best.end < 0) {
+			best.end = i + 1;
+			best.is_arc = false;
+			best.ccw = false;
+			best.center_x = best.center_y = 0;
+			double dx = (double) ((*run)[i + 1].x - (*run)[i].x);
+			double dy = (double) ((*run)[i + 1].y - (*run)[i].y);
+			best.length = sqrt(dx * dx + dy * dy);
+		}
+
+		moves->push_back(best);
+		i = best.end;
+
+	}
+
+}
+
+/*
+*
+*	Adds p, relative to the arc's first vertex, to the moments the circle is fitted from
+*
+*/
+void ArcFitter::add_point(const vertex<int> *origin, const vertex<int> *p) {
+	double x = (double) (p->x - origin->x);
+	double y = (double) (p->y - origin->y);
+	double z = x * x + y * y;
+	sum_xx += x * x;
+	sum_yy += y * y;
+	sum_xy += x * y;
+	sum_zx += z * x;
+	sum_zy += z * y;
+}
+
+/*
+*
+*	Fits a circle through the first and last vertices of run[first, last] that best fits the
+*	ones between them (least squares on the algebraic distance, whose center lies on the
+*	chord's perpendicular bisector, so it only takes the sums above). It's accepted if every
+*	vertex lies within tolerance of it, the vertices go round it in one direction and less than
+*	once, and no segment's chord strays more than tolerance from the arc over it
+*
+*/
+bool ArcFitter::fit_arc(const vector<vertex<int> > *run, int first, int last, arc_move *arc) {
+
+	// Relative to the first vertex. The center is c/2 + t * (-cy, cx) for the chord c
+	const vertex<int> *a = &(*run)[first];
+	double cx = (double) ((*run)[last].x - a->x);
+	double cy = (double) ((*run)[last].y - a->y);
+	double num = cx * sum_zy - cy * sum_zx + cx * cy * (sum_xx - sum_yy) + (cy * cy - cx * cx) * sum_xy;
+	double den = cy * cy * sum_xx - 2.0 * cx * cy * sum_xy + cx * cx * sum_yy;
+	if (den < 1e-9) return false;
+	double t = num / (2.0 * den);
+	double ux = cx / 2.0 - t * cy;
+	double uy = cy / 2.0 + t * cx;
+	double r = sqrt(ux * ux + uy * uy);
+	if (r > ARC_MAX_RADIUS) return false;
+
+	// Squared bounds, so that the loop needs no square roots
+	double min_r = max(0.0, r - tolerance);
+	double min_r_sq = min_r * min_r;
+	double max_r_sq = (r + tolerance) * (r + tolerance);
+	double max_chord_sq = max(0.0, 4.0 * (2.0 * r * tolerance - tolerance * tolerance));
+
+	// The arc has gone round more than once if it crosses back over the first vertex's side of
+	// the center after passing the opposite side
+	double ax = -ux;
+	double ay = -uy;
+	int direction = 0;
+	bool past_half = false;
+
+	for (int k = first; k < last; k++) {
+
+		double px = (double) ((*run)[k].x - a->x) - ux;
+		double py = (double) ((*run)[k].y - a->y) - uy;
+		double qx = (double) ((*run)[k + 1].x - a->x) - ux;
+		double qy = (double) ((*run)[k + 1].y - a->y) - uy;
+
+		double dist_sq = qx * qx + qy * qy;
+		if (dist_sq < min_r_sq || dist_sq > max_r_sq) return false;
+
+		// A step straight towards or away from the center doesn't turn either way
+		double cross = px * qy - py * qx;
+		if (cross != 0) {
+			int turn = cross > 0 ? 1 : -1;
+			if (direction && turn != direction) return false;
+			direction = turn;
+		}
+
+		double chord_x = qx - px;
+		double chord_y = qy - py;
+		if (chord_x * chord_x + chord_y * chord_y > max_chord_sq) return false;
+
+		double side = (double) direction * (ax * qy - ay * qx);
+		if (side < 0) past_half = true;
+		else if (side > 0 && past_half) return false;
+
+	}
+	if (!direction) return false;
+
+	double cx_c = cx - ux;
+	double cy_c = cy - uy;
+	double sweep = atan2((double) direction * (ax * cy_c - ay * cx_c), ax * cx_c + ay * cy_c);
+	if (sweep <= 0) sweep += 2.0 * M_PI;
+	if (sweep > ARC_MAX_SWEEP) return false;
+
+	arc->end = last;
+	arc->is_arc = true;
+	arc->ccw = direction > 0;
+	arc->center_x = (double) a->x + ux;
+	arc->center_y = (double) a->y + uy;
+	arc->length = r * sweep;
+	return true;
+
+}
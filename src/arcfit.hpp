@@ -0,0 +1,31 @@
+#ifndef ARCFIT_H
+#define ARCFIT_H
+
+#include <vector>
+#include "vertex.hpp"
+
+struct arc_move {
+	int end;
+	bool is_arc;
+	bool ccw;
+	double center_x;
+	double center_y;
+	double length;
+};
+
+class ArcFitter {
+	public:
+		ArcFitter(double _tolerance);
+		void fit(const std::vector<vertex<int> > *run, std::vector<arc_move> *moves);
+	private:
+		void add_point(const vertex<int> *origin, const vertex<int> *p);
+		bool fit_arc(const std::vector<vertex<int> > *run, int first, int last, arc_move *arc);
+		double tolerance;
+		double sum_xx;
+		double sum_yy;
+		double sum_xy;
+		double sum_zx;
+		double sum_zy;
+};
+
+#endif
@@ -0,0 +1,300 @@
+#include <limits>
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "bands.hpp"
+
+#define STL_HEADER_SIZE 84
+#define STL_FACET_SIZE 50
+#define READ_CHUNK_FACETS 65536
+#define SPILL_BUFFER_FACETS 4096
+#define MIN_SPILL_BUFFER_FACETS 64
+#define BAND_BYTES_PER_FACET 256
+
+using namespace std;
+
+/*
+*
+*	Calls f on every facet of a binary STL file, reading it a chunk at a time. Returns 0 if the
+*	file ends early
+*
+*/
+template <typename F>
+static int read_facets(FILE *in, int num_facets, F f) {
+
+	vector<char> chunk((size_t) READ_CHUNK_FACETS * STL_FACET_SIZE);
+	if (fseek(in, STL_HEADER_SIZE, SEEK_SET) != 0) return 0;
+
+	for (int begin = 0; begin < num_facets; begin += READ_CHUNK_FACETS) {
+		int count = min(READ_CHUNK_FACETS, num_facets - begin);
+		if (fread(&chunk[0], STL_FACET_SIZE, (size_t) count, in) != (size_t) count) return 0;
+		for (int i = 0; i < count; i++) {
+			facet curr;
+			memcpy((void *) curr.a, (const void *) (&chunk[0] + (size_t) i * STL_FACET_SIZE + 12), (size_t) 36);
+			f(&curr);
+		}
+	}
+
+	return 1;
+
+}
+
+/*
+*
+*	Bands split a binary STL model that may not fit in memory into z-bands of consecutive
+*	planes, spilling each band's facets to its own temporary file, so that the model can be
+*	sliced one band at a time (see Slices::make_slices). Facets are centered exactly as
+*	Mesh::load_STL would, and welded and scaled as each band is loaded, so the bands match the
+*	in-memory mesh. A facet spanning several bands is spilled to each of them
+*
+*/
+Bands::Bands() {
+	num_planes = 0;
+	slice_thickness = 0;
+	scale = 1.0f;
+	weld_tolerance = -1.0f;
+}
+
+/*
+*
+*	Makes three streaming passes over the file: one for the model's bounds, one to count how
+*	many facets reach each plane, and one to spill every facet to the bands it reaches. Bands
+*	are grown plane by plane until the facets they hold would take more than memory_budget
+*	bytes once loaded; a single plane that needs more still gets a band of its own
+*
+*/
+int Bands::split(string filename, float _scale, float _slice_thickness, size_t memory_budget) {
+
+	close_spills();
+	scale = _scale;
+	slice_thickness = _slice_thickness;
+
+	FILE *in = fopen(filename.c_str(), "rb");
+	if (!in) return 0;
+
+	// The facet count is a little-endian uint32, and the file must be large enough to hold that many facets
+	struct stat file_stat;
+	char header[STL_HEADER_SIZE];
+	uint32_t facets_raw = 0;
+	if (fstat(fileno(in), &file_stat) < 0 || file_stat.st_size < STL_HEADER_SIZE ||
+		fread(header, 1, STL_HEADER_SIZE, in) != STL_HEADER_SIZE) {
+		fclose(in);
+		return 0;
+	}
+	memcpy(&facets_raw, header + 80, 4);
+	if (!facets_raw || facets_raw > (uint32_t) numeric_limits<int>::max() ||
+		((size_t) file_stat.st_size - STL_HEADER_SIZE) / STL_FACET_SIZE < facets_raw) {
+		fclose(in);
+		return 0;
+	}
+	int num_facets = (int) facets_raw;
+
+	// Pass 1: the model's bounds, which fix the shift applied to every vertex
+	float bounds[3][2];
+	for (int j = 0; j < 3; j++) {
+		bounds[j][0] = numeric_limits<float>::max();
+		bounds[j][1] = numeric_limits<float>::lowest();
+	}
+	int read = read_facets(in, num_facets, [&](const facet *f) {
+		for (int j = 0; j < 3; j++) {
+			bounds[j][0] = min(bounds[j][0], min(f->a[j], min(f->b[j], f->c[j])));
+			bounds[j][1] = max(bounds[j][1], max(f->a[j], max(f->b[j], f->c[j])));
+		}
+	});
+	if (!read) {
+		fclose(in);
+		return 0;
+	}
+
+	float shift[3];
+	shift[0] = (bounds[0][1] + bounds[0][0]) / 2.0f;
+	shift[1] = (bounds[1][1] + bounds[1][0]) / 2.0f;
+	shift[2] = bounds[2][0];
+
+	// Facets are spilled centered but unscaled, so that load_band can weld them in the model's
+	// units and then scale them, in the same order as the in-memory path
+	auto center = [&](facet *f) {
+		for (int j = 0; j < 3; j++) {
+			f->a[j] = f->a[j] - shift[j];
+			f->b[j] = f->b[j] - shift[j];
+			f->c[j] = f->c[j] - shift[j];
+		}
+	};
+	auto transform = [&](facet *f) {
+		center(f);
+		for (int j = 0; j < 3; j++) {
+			f->a[j] = f->a[j] * scale;
+			f->b[j] = f->b[j] * scale;
+			f->c[j] = f->c[j] * scale;
+		}
+	};
+
+	float height = (bounds[2][1] - shift[2]) * scale - (bounds[2][0] - shift[2]) * scale;
+	if (!(height > 0)) {
+		fclose(in);
+		return 0;
+	}
+	num_planes = ((int) (height / slice_thickness)) + 2;
+
+	// Pass 2: how many facets first and last reach each plane
+	vector<int> starts(num_planes, 0);
+	vector<int> ends(num_planes, 0);
+	read = read_facets(in, num_facets, [&](const facet *raw) {
+		facet f = *raw;
+		transform(&f);
+		int low_plane, high_plane;
+		get_planes(&f, &low_plane, &high_plane);
+		if (low_plane > high_plane) return;
+		starts[low_plane]++;
+		ends[high_plane]++;
+	});
+	if (!read) {
+		fclose(in);
+		return 0;
+	}
+
+	// Grow each band until the facets reaching its planes exceed the budget. A new band starts
+	// with the facets that reach into it from below (carry)
+	int64_t max_band_facets = max((int64_t) 1, (int64_t) (memory_budget / BAND_BYTES_PER_FACET));
+	vector<int> band_of_plane(num_planes);
+	int64_t carry = 0;
+	int64_t count = 0;
+	int first_plane = 0;
+	band_first_plane.push_back(0);
+	for (int p = 0; p < num_planes; p++) {
+		if (p > first_plane && count + starts[p] > max_band_facets) {
+			first_plane = p;
+			count = carry;
+			band_first_plane.push_back(p);
+		}
+		band_of_plane[p] = (int) band_first_plane.size() - 1;
+		count += starts[p];
+		carry += starts[p] - ends[p];
+	}
+	vector<int>().swap(starts);
+	vector<int>().swap(ends);
+
+	int num_bands = (int) band_first_plane.size();
+	band_facets.assign(num_bands, 0);
+	for (int b = 0; b < num_bands; b++) {
+		FILE *spill = tmpfile();
+		if (!spill) {
+			fclose(in);
+			close_spills();
+			return 0;
+		}
+		spills.push_back(spill);
+	}
+
+	// Pass 3: spill every facet to the bands it reaches, through a small buffer per band
+	size_t buffer_facets = memory_budget / (4 * sizeof(facet) * (size_t) num_bands);
+	buffer_facets = max((size_t) MIN_SPILL_BUFFER_FACETS, min((size_t) SPILL_BUFFER_FACETS, buffer_facets));
+	vector<vector<facet> > buffers(num_bands);
+	bool written = true;
+	auto flush = [&](int b) {
+		if (!buffers[b].empty() && fwrite(&buffers[b][0], sizeof(facet), buffers[b].size(), spills[b]) != buffers[b].size())
+			written = false;
+		buffers[b].clear();
+	};
+
+	read = read_facets(in, num_facets, [&](const facet *raw) {
+		facet f = *raw;
+		facet centered = *raw;
+		transform(&f);
+		center(&centered);
+		int low_plane, high_plane;
+		get_planes(&f, &low_plane, &high_plane);
+		if (low_plane > high_plane) return;
+		for (int b = band_of_plane[low_plane]; b <= band_of_plane[high_plane]; b++) {
+			buffers[b].push_back(centered);
+			band_facets[b]++;
+			if (buffers[b].size() >= buffer_facets) flush(b);
+		}
+	});
+	fclose(in);
+
+	for (int b = 0; b < num_bands; b++)
+		flush(b);
+	if (!read || !written) {
+		close_spills();
+		return 0;
+	}
+
+	return 1;
+
+}
+
+/*
+*
+*	Planes a (transformed) facet reaches, by the same rule the sweep uses, widened by one plane
+*	on either side so that welding can't move a vertex into a plane whose band lacks the facet.
+*	low_plane > high_plane if the facet lies between two planes
+*
+*/
+void Bands::get_planes(const facet *f, int *low_plane, int *high_plane) {
+	float z_min = min(f->a[2], min(f->b[2], f->c[2]));
+	float z_max = max(f->a[2], max(f->b[2], f->c[2]));
+	*low_plane = (int) ceilf(z_min / slice_thickness);
+	*high_plane = (int) floorf(z_max / slice_thickness);
+	if (*low_plane > *high_plane) return;
+	*low_plane = max(*low_plane - 1, 0);
+	*high_plane = min(*high_plane + 1, num_planes - 1);
+}
+
+/*
+*
+*	Welds each band as it's loaded (see Mesh::weld), with a tolerance in the model's units.
+*	A negative tolerance (the default) leaves bands unwelded
+*
+*/
+void Bands::set_weld(float tolerance) { weld_tolerance = tolerance; }
+
+int Bands::get_num_bands() { return (int) band_first_plane.size(); }
+
+int Bands::get_num_planes() { return num_planes; }
+
+float Bands::get_slice_thickness() { return slice_thickness; }
+
+void Bands::get_band_planes(int band, int *first_plane, int *last_plane) {
+	*first_plane = band_first_plane[band];
+	*last_plane = band + 1 < get_num_bands() ? band_first_plane[band + 1] - 1 : num_planes - 1;
+}
+
+/*
+*
+*	Loads one band's facets into a mesh, welding (see set_weld) and then scaling them like the
+*	in-memory path does. Each band is meant to be loaded once: its spill file is
+*	closed (and so deleted) afterwards. Returns 0 if the band holds no facets
+*
+*/
+int Bands::load_band(int band, Mesh *out) {
+
+	if (!spills[band] || !band_facets[band]) return 0;
+
+	rewind(spills[band]);
+	int loaded = out->load_facets(spills[band], band_facets[band]);
+	fclose(spills[band]);
+	spills[band] = NULL;
+	if (!loaded) return 0;
+
+	if (weld_tolerance >= 0) out->weld(weld_tolerance);
+	out->scale_mesh(scale);
+	return 1;
+
+}
+
+void Bands::close_spills() {
+	for (int b = 0; b < (int) spills.size(); b++) {
+		if (spills[b]) fclose(spills[b]);
+	}
+	spills.clear();
+	band_facets.clear();
+	band_first_plane.clear();
+}
+
+Bands::~Bands() {
+	close_spills();
+}
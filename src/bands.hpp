@@ -0,0 +1,33 @@
+#ifndef BANDS_H
+#define BANDS_H
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stddef.h>
+#include "mesh.hpp"
+
+class Bands {
+	public:
+		Bands();
+		int split(std::string filename, float _scale, float _slice_thickness, size_t memory_budget);
+		void set_weld(float tolerance);
+		int get_num_bands();
+		int get_num_planes();
+		float get_slice_thickness();
+		void get_band_planes(int band, int *first_plane, int *last_plane);
+		int load_band(int band, Mesh *out);
+		~Bands();
+	private:
+		void get_planes(const facet *f, int *low_plane, int *high_plane);
+		void close_spills();
+		std::vector<FILE*> spills;
+		std::vector<int> band_facets;
+		std::vector<int> band_first_plane;
+		int num_planes;
+		float slice_thickness;
+		float scale;
+		float weld_tolerance;
+};
+
+#endif
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <math.h>
+#include <chrono>
+#include <fstream>
+
+#include "bench.hpp"
+#include "mesh.hpp"
+#include "slices.hpp"
+#include "intersect.hpp"
+#include "parallel.hpp"
+#include "gcode.hpp"
+#include "infill.hpp"
+#include "offset.hpp"
+
+#define BENCH_REPEATS 3
+#define BENCH_SCALE 9.0f
+#define BENCH_THICKNESS 1.0f
+#define BENCH_DIM 900
+#define BENCH_INFILL_SPACING 18.0f
+#define BENCH_SHELLS 3
+#define BENCH_SHELL_WIDTH 3.6f
+
+using namespace std;
+
+static double elapsed_ms(chrono::steady_clock::time_point start) {
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+/*
+*
+*	The thread counts to time: 1, 2, 4, ... up to (but not including) every core, then every
+*	core
+*
+*/
+static vector<int> get_thread_counts() {
+	int max_threads = get_num_threads(0);
+	vector<int> counts;
+	for (int t = 1; t < max_threads; t *= 2)
+		counts.push_back(t);
+	counts.push_back(max_threads);
+	return counts;
+}
+
+/*
+*
+*	Loads the model every benchmark but bench_load slices, welded and scaled like main does.
+*	Returns false (after saying so) if it can't be loaded
+*
+*/
+static bool load_bench_mesh(string filename, Mesh *m) {
+	if (!m->load_STL(filename)) {
+		printf("Couldn't load %s\n", filename.c_str());
+		return false;
+	}
+	m->weld(0);
+	m->scale_mesh(BENCH_SCALE);
+	return true;
+}
+
+/*
+*
+*	Measures STL load throughput (MB/s) for increasing thread counts, keeping the best of
+*	several runs so that the first, cold-cache load doesn't skew the numbers
+*
+*/
+static void bench_load(string filename) {
+
+	ifstream f(filename, ios::in | ios::binary | ios::ate);
+	if (!f) {
+		printf("Couldn't load %s\n", filename.c_str());
+		return;
+	}
+	double file_mb = (double) f.tellg() / (1024.0 * 1024.0);
+	f.close();
+
+	vector<int> thread_counts = get_thread_counts();
+	printf("Load: %s (%.1f MB)\n", filename.c_str(), file_mb);
+	for (int c = 0; c < (int) thread_counts.size(); c++) {
+		int t = thread_counts[c];
+		double best = -1;
+		for (int r = 0; r < BENCH_REPEATS; r++) {
+			Mesh m;
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			if (!m.load_STL(filename, t)) {
+				printf("Couldn't load %s\n", filename.c_str());
+				return;
+			}
+			double ms = elapsed_ms(start);
+			if (best < 0 || ms < best) best = ms;
+		}
+		printf("  %2d threads: %8.2f ms  %8.1f MB/s\n", t, best, file_mb / (best / 1000.0));
+	}
+
+}
+
+/*
+*
+*	Compares the time spent cutting facets in the sweep with the scalar get_points path against
+*	the SIMD kernel. Both runs use the chaining contour engine so the raster doesn't dominate,
+*	and the total number of contour points is printed as a sanity check
+*
+*/
+static void bench_intersect(string filename) {
+
+	Mesh m;
+	if (!load_bench_mesh(filename, &m)) return;
+
+	int kernels[2] = { KERNEL_SCALAR, KERNEL_SIMD };
+	const char *names[2] = { "scalar", Intersector::get_isa() };
+	double times[2];
+
+	for (int k = 0; k < 2; k++) {
+		Slices s;
+		s.set_contour_engine(CONTOUR_CHAIN);
+		s.set_sweep(true);
+		s.set_kernel(kernels[k]);
+		s.make_slices(&m, BENCH_THICKNESS, BENCH_DIM, 0);
+
+		long num_points = 0;
+		for (int i = 0; i < s.get_num_planes(); i++) {
+			for (int j = 0; j < (int) s.contours[i].size(); j++)
+				num_points += (long) s.contours[i][j].size();
+		}
+		times[k] = s.intersect_ms;
+		printf("Intersect (%s): %8.2f ms, %ld contour points\n", names[k], times[k], num_points);
+	}
+
+	printf("Intersect speedup: %.2fx\n", times[0] / times[1]);
+
+}
+
+/*
+*
+*	Times contour extraction and pruning with the raster engine (the expensive one) for
+*	increasing thread counts, and checks that every thread count gives the same contours as
+*	the single-threaded run
+*
+*/
+static void bench_contours(string filename) {
+
+	Mesh m;
+	if (!load_bench_mesh(filename, &m)) return;
+
+	vector<vector<vector<cv::Point> > > reference;
+	vector<int> thread_counts = get_thread_counts();
+	for (int c = 0; c < (int) thread_counts.size(); c++) {
+		int t = thread_counts[c];
+		Slices s;
+		s.set_sweep(true);
+		s.set_num_threads(t);
+		s.make_slices(&m, BENCH_THICKNESS, BENCH_DIM, 0);
+
+		if (t == 1) reference = s.contours;
+		bool same = s.contours == reference;
+		printf("Contours (%2d threads): %8.2f ms%s\n", t, s.contour_ms, same ? "" : "  MISMATCH");
+	}
+
+}
+
+/*
+*
+*	Measures G-code output throughput (MB/s), writing every layer of the sliced model to a
+*	temporary file. Slicing isn't timed
+*
+*/
+static void bench_gcode(string filename) {
+
+	Mesh m;
+	if (!load_bench_mesh(filename, &m)) return;
+
+	Slices s;
+	s.make_slices(&m, BENCH_THICKNESS, BENCH_DIM, 0);
+
+	string path = filename + ".bench.gcode";
+	double best = -1;
+	double out_mb = 0;
+	for (int r = 0; r < BENCH_REPEATS; r++) {
+		GcodeWriter g;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		if (!g.open(path, BENCH_DIM, BENCH_THICKNESS, 1.0f / BENCH_SCALE)) {
+			printf("Couldn't write %s\n", path.c_str());
+			return;
+		}
+		for (int i = 0; i < s.get_num_planes(); i++)
+			g.write_layer(i, s.get_layer(i));
+		bool written = g.close();
+		double ms = elapsed_ms(start);
+		if (!written) {
+			printf("Couldn't write %s\n", path.c_str());
+			remove(path.c_str());
+			return;
+		}
+		out_mb = (double) g.get_bytes_written() / (1024.0 * 1024.0);
+		if (best < 0 || ms < best) best = ms;
+	}
+	remove(path.c_str());
+
+	printf("G-code: %.1f MB in %8.2f ms  %8.1f MB/s\n", out_mb, best, out_mb / (best / 1000.0));
+
+}
+
+/*
+*
+*	Times hatching every layer with the scanline Infill against rasterizing the layer's closed
+*	polygons into a cv::Mat with fillPoly and reading the same horizontal scanlines back out of
+*	it, and compares how much line each finds (the raster is only pixel-accurate)
+*
+*/
+static void bench_infill(string filename) {
+
+	Mesh m;
+	if (!load_bench_mesh(filename, &m)) return;
+
+	Slices s;
+	s.make_slices(&m, BENCH_THICKNESS, BENCH_DIM, 0);
+	int num_planes = s.get_num_planes();
+
+	Infill infill;
+	vector<hatch_line> lines;
+	double scan_length = 0;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int i = 0; i < num_planes; i++) {
+		infill.fill(s.get_layer(i)->get_polygons(), BENCH_INFILL_SPACING, 0, &lines);
+		for (int k = 0; k < (int) lines.size(); k++)
+			scan_length += fabs(lines[k].end.x - lines[k].start.x);
+	}
+	double scan_ms = elapsed_ms(start);
+
+	cv::Mat image(BENCH_DIM, BENCH_DIM, CV_8UC1);
+	vector<vector<cv::Point> > outlines;
+	double raster_length = 0;
+	start = chrono::steady_clock::now();
+	for (int i = 0; i < num_planes; i++) {
+		Polygons *layer = s.get_layer(i);
+		outlines.clear();
+		for (int j = 0; j < layer->get_num_polys(); j++) {
+			Polygon *p = layer->get_polygon(j);
+			if (p->get_size() < 3 || p->is_open()) continue;
+			outlines.push_back(vector<cv::Point>());
+			for (int k = 0; k < p->get_size(); k++)
+				outlines.back().push_back(cv::Point(p->vertices[k].x, p->vertices[k].y));
+		}
+		image.setTo(cv::Scalar(0));
+		if (!outlines.empty()) cv::fillPoly(image, outlines, cv::Scalar(255));
+		for (int row = 0; (row + 0.5f) * BENCH_INFILL_SPACING < BENCH_DIM; row++) {
+			const unsigned char *pixels = image.ptr((int) ((row + 0.5f) * BENCH_INFILL_SPACING));
+			for (int x = 0; x < BENCH_DIM; x++)
+				raster_length += pixels[x] ? 1 : 0;
+		}
+	}
+	double raster_ms = elapsed_ms(start);
+
+	printf("Infill (scanline): %8.2f ms, %.0f px of line\n", scan_ms, scan_length);
+	printf("Infill (raster):   %8.2f ms, %.0f px of line\n", raster_ms, raster_length);
+	printf("Infill speedup: %.2fx\n", raster_ms / scan_ms);
+
+}
+
+/*
+*
+*	Times offsetting every layer into BENCH_SHELLS shells (see Offsetter) for increasing thread
+*	counts, and checks that every thread count traces the same number of shell vertices as the
+*	single-threaded run. Slicing isn't timed
+*
+*/
+static void bench_shells(string filename) {
+
+	Mesh m;
+	if (!load_bench_mesh(filename, &m)) return;
+
+	Slices s;
+	s.make_slices(&m, BENCH_THICKNESS, BENCH_DIM, 0);
+	int num_planes = s.get_num_planes();
+	vector<Polygons*> layers(num_planes);
+	for (int i = 0; i < num_planes; i++)
+		layers[i] = s.get_layer(i);
+
+	vector<float> distances(BENCH_SHELLS);
+	for (int k = 0; k < BENCH_SHELLS; k++)
+		distances[k] = ((float) k + 0.5f) * BENCH_SHELL_WIDTH;
+
+	long reference = -1;
+	vector<int> thread_counts = get_thread_counts();
+	for (int c = 0; c < (int) thread_counts.size(); c++) {
+		int t = thread_counts[c];
+		vector<Offsetter> offsetters(t);
+		vector<long> points(num_planes, 0);
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		parallel_for_each(num_planes, t, [&](int i, int thread) {
+			vector<vector<vector<cv::Point> > > offsets;
+			offsetters[thread].offset(layers[i]->get_polygons(), &distances, &offsets);
+			for (int k = 0; k < (int) offsets.size(); k++)
+				for (int j = 0; j < (int) offsets[k].size(); j++)
+					points[i] += (long) offsets[k][j].size();
+		});
+		double ms = elapsed_ms(start);
+
+		long total = 0;
+		for (int i = 0; i < num_planes; i++)
+			total += points[i];
+		if (t == 1) reference = total;
+		printf("Shells (%2d threads): %8.2f ms, %ld points%s\n", t, ms, total, total == reference ? "" : "  MISMATCH");
+	}
+
+}
+
+void run_benchmarks(string filename) {
+	bench_load(filename);
+	bench_intersect(filename);
+	bench_contours(filename);
+	bench_gcode(filename);
+	bench_infill(filename);
+	bench_shells(filename);
+}
@@ -0,0 +1,8 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+
+void run_benchmarks(std::string filename);
+
+#endif
@@ -0,0 +1,177 @@
+#include <math.h>
+#include <algorithm>
+#include <utility>
+#include <assert.h>
+#include "chainer.hpp"
+
+using namespace std;
+
+/*
+*
+*	A Chainer links the intersection segments of a slice directly into polylines, without
+*	drawing them. Segment endpoints are hashed on a fixed-point grid with 1/precision spacing,
+*	so endpoints that only differ by float rounding resolve to the same node.
+*
+*/
+Chainer::Chainer(float _precision) { precision = _precision; }
+
+/*
+*
+*	Links a flat list of segments (start, end, start, end, ...) into polylines. Closed
+*	polylines repeat their first point at the end; chains that can't be closed (e.g. from
+*	non-manifold meshes) are emitted as open polylines
+*
+*/
+void Chainer::link(vector<vertex<float> > *segments, vector<vector<vertex<float> > > *polylines) {
+
+	node_ids.clear();
+	nodes.clear();
+	seg_nodes.clear();
+
+	int num_points = (int) segments->size();
+	for (int i = 0; i + 1 < num_points; i += 2) {
+		int a = get_node(&(*segments)[i]);
+		int b = get_node(&(*segments)[i + 1]);
+		if (a == b) continue;
+		seg_nodes.push_back(a);
+		seg_nodes.push_back(b);
+	}
+
+	remove_duplicates();
+
+	int num_segs = (int) seg_nodes.size() / 2;
+	int num_nodes = (int) nodes.size();
+
+	// Build node -> incident segment lists in a single flat array
+	adj_start.assign(num_nodes + 1, 0);
+	for (int i = 0; i < 2 * num_segs; i++)
+		adj_start[seg_nodes[i] + 1]++;
+	for (int i = 0; i < num_nodes; i++)
+		adj_start[i + 1] += adj_start[i];
+
+	adj_segs.resize(2 * num_segs);
+	vector<int> fill(adj_start.begin(), adj_start.end() - 1);
+	for (int i = 0; i < 2 * num_segs; i++)
+		adj_segs[fill[seg_nodes[i]]++] = i / 2;
+
+	used.assign(num_segs, false);
+
+	// Start from dangling endpoints first so that open chains come out in one piece
+	for (int n = 0; n < num_nodes; n++) {
+		if ((adj_start[n + 1] - adj_start[n]) % 2 == 0) continue;
+		for (int k = adj_start[n]; k < adj_start[n + 1]; k++) {
+			if (used[adj_segs[k]]) continue;
+			vector<vertex<float> > polyline;
+			follow(n, &polyline);
+			polylines->push_back(polyline);
+		}
+	}
+
+	// Everything left belongs to a loop
+	for (int s = 0; s < num_segs; s++) {
+		if (used[s]) continue;
+		vector<vertex<float> > polyline;
+		follow(seg_nodes[2 * s], &polyline);
+		polylines->push_back(polyline);
+	}
+
+}
+
+/*
+*
+*	Drops all but one copy of segments joining the same two nodes. An edge lying exactly in
+*	the plane is emitted by both facets that share it, and chaining the two copies would
+*	double straight back along it and split the contour into slivers
+*
+*/
+void Chainer::remove_duplicates() {
+
+	int num_segs = (int) seg_nodes.size() / 2;
+	vector<pair<int64_t, int> > keys(num_segs);
+	for (int s = 0; s < num_segs; s++) {
+		int a = min(seg_nodes[2 * s], seg_nodes[2 * s + 1]);
+		int b = max(seg_nodes[2 * s], seg_nodes[2 * s + 1]);
+		keys[s] = make_pair(get_key(a, b), s);
+	}
+	sort(keys.begin(), keys.end());
+
+	vector<bool> keep(num_segs, true);
+	for (int k = 1; k < num_segs; k++)
+		if (keys[k].first == keys[k - 1].first) keep[keys[k].second] = false;
+
+	int kept = 0;
+	for (int s = 0; s < num_segs; s++) {
+		if (!keep[s]) continue;
+		seg_nodes[2 * kept] = seg_nodes[2 * s];
+		seg_nodes[2 * kept + 1] = seg_nodes[2 * s + 1];
+		kept++;
+	}
+	seg_nodes.resize(2 * kept);
+
+}
+
+/*
+*
+*	Walks unused segments from start_node until it either returns to start_node or reaches
+*	a node with no unused segments left. Returns the node the walk ended on
+*
+*/
+int Chainer::follow(int start_node, vector<vertex<float> > *polyline) {
+
+	int curr = start_node;
+	polyline->push_back(nodes[curr]);
+
+	while (true) {
+
+		int next_seg = -1;
+		for (int k = adj_start[curr]; k < adj_start[curr + 1]; k++) {
+			if (!used[adj_segs[k]]) {
+				next_seg = adj_segs[k];
+				break;
+			}
+		}
+		if (next_seg < 0) break;
+
+		used[next_seg] = true;
+		curr = (seg_nodes[2 * next_seg] == curr) ? seg_nodes[2 * next_seg + 1] : seg_nodes[2 * next_seg];
+		polyline->push_back(nodes[curr]);
+		if (curr == start_node) break;
+
+	}
+
+	return curr;
+
+}
+
+/*
+*
+*	Returns the id of the node at v's grid cell, creating it if needed. If the cell is empty
+*	the neighbouring cells are checked too, so two nearly equal points that happen to straddle
+*	a cell boundary still end up as one node
+*
+*/
+int Chainer::get_node(const vertex<float> *v) {
+
+	int64_t qx = (int64_t) floor((double) v->x * precision + 0.5);
+	int64_t qy = (int64_t) floor((double) v->y * precision + 0.5);
+
+	unordered_map<int64_t, int>::iterator it = node_ids.find(get_key(qx, qy));
+	if (it != node_ids.end()) return it->second;
+
+	for (int dx = -1; dx <= 1; dx++) {
+		for (int dy = -1; dy <= 1; dy++) {
+			it = node_ids.find(get_key(qx + dx, qy + dy));
+			if (it != node_ids.end()) return it->second;
+		}
+	}
+
+	int id = (int) nodes.size();
+	nodes.push_back(*v);
+	node_ids[get_key(qx, qy)] = id;
+	return id;
+
+}
+
+int64_t Chainer::get_key(int64_t qx, int64_t qy) {
+	return (int64_t) (((uint64_t) qx << 32) ^ ((uint64_t) qy & 0xffffffffULL));
+}
@@ -0,0 +1,27 @@
+#ifndef CHAINER_H
+#define CHAINER_H
+
+#include <vector>
+#include <stdint.h>
+#include <unordered_map>
+#include "vertex.hpp"
+
+class Chainer {
+	public:
+		Chainer(float _precision);
+		void link(std::vector<vertex<float> > *segments, std::vector<std::vector<vertex<float> > > *polylines);
+	private:
+		int get_node(const vertex<float> *v);
+		void remove_duplicates();
+		int follow(int start_node, std::vector<vertex<float> > *polyline);
+		int64_t get_key(int64_t qx, int64_t qy);
+		float precision;
+		std::unordered_map<int64_t, int> node_ids;
+		std::vector<vertex<float> > nodes;
+		std::vector<int> seg_nodes;
+		std::vector<int> adj_start;
+		std::vector<int> adj_segs;
+		std::vector<bool> used;
+};
+
+#endif
@@ -0,0 +1,348 @@
+#include <math.h>
+#include <limits>
+#include <string.h>
+#include "gcode.hpp"
+
+#define GCODE_BUFFER (1 << 20)
+#define GCODE_MAX_LINE 128
+#define XY_DECIMALS 3
+#define E_DECIMALS 5
+#define EXTRUSION_WIDTH 0.4
+#define FILAMENT_DIAMETER 1.75
+#define PRINT_FEEDRATE "1800"
+#define TRAVEL_FEEDRATE "7200"
+#define MOVE_NONE -1
+#define MOVE_TRAVEL 0
+#define MOVE_PRINT 1
+#define ARC_TOLERANCE 1.0
+
+using namespace std;
+
+static const int64_t powers_of_ten[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+/*
+*
+*	A GcodeWriter turns finished layers into G-code as they're handed over, so it can be used as
+*	the sink of a streaming Slices (see Slices::set_streaming). Each layer's polygons are printed
+*	in the order of its path, entering each one at its start_index, or its shells in their
+*	place if it has any (see Slices::set_shells). Numbers are formatted as
+*	fixed-point integers straight into a large buffer, which is written out a block at a time
+*
+*/
+GcodeWriter::GcodeWriter() : arc_fitter(ARC_TOLERANCE) {
+	out = NULL;
+	used = 0;
+	bytes_written = 0;
+	ok = false;
+	mat_dim = 0;
+	slice_thickness = 0;
+	pixel_size = 0;
+	e_per_pixel = 0;
+	e_total = 0;
+	last_move = MOVE_NONE;
+	arcs = false;
+}
+
+/*
+*
+*	Starts filename. Layer coordinates are pixels of a mat_dim x mat_dim image centered on the
+*	model, and pixel_size is the length of a pixel in mm; slice_thickness is in pixels, as for
+*	Slices. Returns 0 if the file can't be created
+*
+*/
+int GcodeWriter::open(string filename, int _mat_dim, float _slice_thickness, float _pixel_size) {
+
+	close();
+	out = fopen(filename.c_str(), "wb");
+	if (!out) return 0;
+	setvbuf(out, NULL, _IONBF, 0);
+
+	mat_dim = _mat_dim;
+	slice_thickness = _slice_thickness;
+	pixel_size = (double) _pixel_size;
+
+	// Filament fed per pixel of path, so that the extruded bead fills the layer
+	double layer_height = (double) slice_thickness * pixel_size;
+	double filament_area = M_PI * FILAMENT_DIAMETER * FILAMENT_DIAMETER / 4.0;
+	e_per_pixel = pixel_size * EXTRUSION_WIDTH * layer_height / filament_area;
+	e_total = 0;
+
+	buffer.resize(GCODE_BUFFER);
+	used = 0;
+	bytes_written = 0;
+	ok = true;
+	last_move = MOVE_NONE;
+	position.x = position.y = numeric_limits<int>::min();
+
+	put("; SimpleSlicer\nG21\nG90\nM82\nG92 E0\n");
+	return 1;
+
+}
+
+/*
+*
+*	Prints curved runs of vertices as G2/G3 arcs (see ArcFitter) within ARC_TOLERANCE pixels of
+*	every vertex they replace, rather than as one G1 per segment. Off by default, since not
+*	all firmware supports arcs
+*
+*/
+void GcodeWriter::set_arcs(bool _arcs) { arcs = _arcs; }
+
+/*
+*
+*	Writes one layer: its outlines, or its shells and any open outlines, then its infill.
+*	Layers must be written in order. Each plane's outlines are printed as the layer resting on
+*	that plane
+*
+*/
+void GcodeWriter::write_layer(int plane_index, Polygons *layer) {
+
+	if (!out) return;
+
+	reserve();
+	put("; LAYER ");
+	put_int(plane_index);
+	put("\nG0 Z");
+	put_fixed(llround((double) (plane_index + 1) * slice_thickness * pixel_size * powers_of_ten[XY_DECIMALS]), XY_DECIMALS);
+	put_char('\n');
+
+	bool shelled = !layer->shells.empty();
+	int num_polys = layer->get_num_polys();
+	for (int j = 0; j < num_polys; j++) {
+		Polygon *p = layer->get_polygon(num_polys > 1 ? layer->path->order[j] : 0);
+		if (!p->get_size() || (shelled && !p->is_open())) continue;
+		write_polygon(p, p->start_index >= 0 ? p->start_index : 0);
+	}
+
+	write_shells(layer);
+	write_infill(layer);
+
+}
+
+/*
+*
+*	Prints the layer's hatch lines (see Infill), if it has any, after its outlines. Their ends
+*	are rounded to the nearest pixel, like the outlines' vertices
+*
+*/
+void GcodeWriter::write_infill(Polygons *layer) {
+	for (int k = 0; k < (int) layer->infill.size(); k++) {
+		const hatch_line *line = &layer->infill[k];
+		vertex<int> start, end;
+		start.x = (int) lroundf(line->start.x);
+		start.y = (int) lroundf(line->start.y);
+		end.x = (int) lroundf(line->end.x);
+		end.y = (int) lroundf(line->end.y);
+		if (start.x == end.x && start.y == end.y) continue;
+		move_to(&start, false);
+		move_to(&end, true);
+	}
+}
+
+/*
+*
+*	Prints the layer's shells from the outermost in, each ring in the order planned for it and
+*	from its start vertex (see Polygons::plan_shells)
+*
+*/
+void GcodeWriter::write_shells(Polygons *layer) {
+	for (int k = 0; k < (int) layer->shells.size(); k++) {
+		vector<Polygon*> *rings = &layer->shells[k];
+		int num_rings = (int) rings->size();
+		for (int j = 0; j < num_rings; j++) {
+			Polygon *ring = (*rings)[num_rings > 1 ? layer->shell_orders[k][j] : 0];
+			if (ring->get_size()) write_polygon(ring, ring->start_index >= 0 ? ring->start_index : 0);
+		}
+	}
+}
+
+/*
+*
+*	Travels to the polygon's start vertex and prints it from there: right round and back to the
+*	start if it's closed, or from its nearer end to its farther one if it's open
+*
+*/
+void GcodeWriter::write_polygon(Polygon *p, int start) {
+
+	int n = p->get_size();
+
+	run.clear();
+	if (p->is_open()) {
+		bool forward = start <= n / 2;
+		for (int k = 0; k < n; k++)
+			add_to_run(&p->vertices[forward ? k : n - 1 - k]);
+	} else {
+		for (int k = 0; k <= n; k++)
+			add_to_run(&p->vertices[(start + k) % n]);
+	}
+
+	move_to(&run[0], false);
+	if (!arcs) {
+		for (int k = 1; k < (int) run.size(); k++)
+			move_to(&run[k], true);
+		return;
+	}
+
+	arc_fitter.fit(&run, &moves);
+	for (int k = 0; k < (int) moves.size(); k++) {
+		if (moves[k].is_arc) arc_to(&run[moves[k].end], &moves[k]);
+		else move_to(&run[moves[k].end], true);
+	}
+
+}
+
+/*
+*
+*	Appends v to the run being printed, unless it repeats the run's last vertex
+*
+*/
+void GcodeWriter::add_to_run(const vertex<int> *v) {
+	if (!run.empty() && run.back().x == v->x && run.back().y == v->y) return;
+	run.push_back(*v);
+}
+
+/*
+*
+*	Emits a travel (G0) or printing (G1) move to v, skipping moves that go nowhere. The feed
+*	rate is only given when switching between the two
+*
+*/
+void GcodeWriter::move_to(const vertex<int> *v, bool extrude) {
+
+	if (v->x == position.x && v->y == position.y) return;
+
+	int move = extrude ? MOVE_PRINT : MOVE_TRAVEL;
+	reserve();
+	if (extrude) put(move == last_move ? "G1 X" : "G1 F" PRINT_FEEDRATE " X");
+	else put(move == last_move ? "G0 X" : "G0 F" TRAVEL_FEEDRATE " X");
+	put_fixed(to_fixed(v->x), XY_DECIMALS);
+	put(" Y");
+	put_fixed(to_fixed(v->y), XY_DECIMALS);
+	if (extrude) {
+		double dx = (double) (v->x - position.x);
+		double dy = (double) (v->y - position.y);
+		e_total += sqrt(dx * dx + dy * dy) * e_per_pixel;
+		put(" E");
+		put_fixed(llround(e_total * powers_of_ten[E_DECIMALS]), E_DECIMALS);
+	}
+	put_char('\n');
+
+	position = *v;
+	last_move = move;
+
+}
+
+/*
+*
+*	Emits an arc from the current position to v, around the arc's center (given relative to
+*	the start, as I and J). G3 goes counterclockwise and G2 clockwise
+*
+*/
+void GcodeWriter::arc_to(const vertex<int> *v, const arc_move *arc) {
+
+	reserve();
+	put(arc->ccw ? "G3 " : "G2 ");
+	if (last_move != MOVE_PRINT) put("F" PRINT_FEEDRATE " ");
+	put_char('X');
+	put_fixed(to_fixed(v->x), XY_DECIMALS);
+	put(" Y");
+	put_fixed(to_fixed(v->y), XY_DECIMALS);
+	put(" I");
+	put_fixed(llround((arc->center_x - (double) position.x) * pixel_size * powers_of_ten[XY_DECIMALS]), XY_DECIMALS);
+	put(" J");
+	put_fixed(llround((arc->center_y - (double) position.y) * pixel_size * powers_of_ten[XY_DECIMALS]), XY_DECIMALS);
+	e_total += arc->length * e_per_pixel;
+	put(" E");
+	put_fixed(llround(e_total * powers_of_ten[E_DECIMALS]), E_DECIMALS);
+	put_char('\n');
+
+	position = *v;
+	last_move = MOVE_PRINT;
+
+}
+
+/*
+*
+*	Finishes the file. Returns 0 if anything couldn't be written
+*
+*/
+int GcodeWriter::close() {
+	if (!out) return 0;
+	put("M107\n");
+	flush();
+	if (fclose(out) != 0) ok = false;
+	out = NULL;
+	vector<char>().swap(buffer);
+	return ok ? 1 : 0;
+}
+
+uint64_t GcodeWriter::get_bytes_written() { return bytes_written; }
+
+/*
+*
+*	Makes room for at least one more line in the buffer
+*
+*/
+void GcodeWriter::reserve() {
+	if (used + GCODE_MAX_LINE > buffer.size()) flush();
+}
+
+void GcodeWriter::flush() {
+	if (used && fwrite(&buffer[0], 1, used, out) != used) ok = false;
+	bytes_written += used;
+	used = 0;
+}
+
+void GcodeWriter::put(const char *s) {
+	size_t n = strlen(s);
+	memcpy(&buffer[used], s, n);
+	used += n;
+}
+
+void GcodeWriter::put_char(char c) {
+	buffer[used++] = c;
+}
+
+void GcodeWriter::put_int(int64_t value) {
+	char digits[24];
+	int n = 0;
+	uint64_t u = value < 0 ? (uint64_t) 0 - (uint64_t) value : (uint64_t) value;
+	do {
+		digits[n++] = (char) ('0' + u % 10);
+		u /= 10;
+	} while (u);
+	if (value < 0) put_char('-');
+	while (n)
+		put_char(digits[--n]);
+}
+
+/*
+*
+*	Writes value / 10^decimals with exactly that many decimals, e.g. -1205 with 3 decimals is
+*	"-1.205"
+*
+*/
+void GcodeWriter::put_fixed(int64_t value, int decimals) {
+	if (value < 0) {
+		put_char('-');
+		value = -value;
+	}
+	put_int(value / powers_of_ten[decimals]);
+	put_char('.');
+	int64_t fraction = value % powers_of_ten[decimals];
+	for (int d = decimals - 1; d >= 0; d--)
+		put_char((char) ('0' + (fraction / powers_of_ten[d]) % 10));
+}
+
+/*
+*
+*	A pixel coordinate in thousandths of a mm, relative to the model's center
+*
+*/
+int64_t GcodeWriter::to_fixed(int pixel) {
+	return llround((double) (pixel - mat_dim / 2) * pixel_size * powers_of_ten[XY_DECIMALS]);
+}
+
+GcodeWriter::~GcodeWriter() {
+	close();
+}
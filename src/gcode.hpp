@@ -0,0 +1,52 @@
+#ifndef GCODE_H
+#define GCODE_H
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+#include "polygons.hpp"
+#include "arcfit.hpp"
+
+class GcodeWriter {
+	public:
+		GcodeWriter();
+		int open(std::string filename, int _mat_dim, float _slice_thickness, float _pixel_size);
+		void set_arcs(bool _arcs);
+		void write_layer(int plane_index, Polygons *layer);
+		int close();
+		uint64_t get_bytes_written();
+		~GcodeWriter();
+	private:
+		void write_polygon(Polygon *p, int start);
+		void write_shells(Polygons *layer);
+		void write_infill(Polygons *layer);
+		void move_to(const vertex<int> *v, bool extrude);
+		void arc_to(const vertex<int> *v, const arc_move *arc);
+		void add_to_run(const vertex<int> *v);
+		void reserve();
+		void flush();
+		void put(const char *s);
+		void put_char(char c);
+		void put_int(int64_t value);
+		void put_fixed(int64_t value, int decimals);
+		int64_t to_fixed(int pixel);
+		FILE *out;
+		std::vector<char> buffer;
+		size_t used;
+		uint64_t bytes_written;
+		bool ok;
+		int mat_dim;
+		float slice_thickness;
+		double pixel_size;
+		double e_per_pixel;
+		double e_total;
+		vertex<int> position;
+		int last_move;
+		bool arcs;
+		ArcFitter arc_fitter;
+		std::vector<vertex<int> > run;
+		std::vector<arc_move> moves;
+};
+
+#endif
@@ -0,0 +1,184 @@
+#include <math.h>
+#include <algorithm>
+#include "infill.hpp"
+
+#define MIN_HATCH_LENGTH 1.0f
+
+using namespace std;
+
+/*
+*
+*	An Infill hatches the inside of a set of closed polygons (a layer's outlines, or the region
+*	inside its shells; see Slices::set_shells) with parallel lines spacing pixels apart, at angle
+*	radians from the x-axis. The polygons are rotated so that the hatch lines are horizontal,
+*	and their edges are swept bottom to top: an edge table sorted by lowest y feeds an
+*	active-edge list, and each scanline crosses only the active edges. The active edges are
+*	kept as separate arrays of floats so that the crossings are computed in one vectorizable
+*	loop. Crossings are paired even-odd, so holes are left empty. Scanlines lie on a grid fixed
+*	in space, so layers hatched at the same angle line up
+*
+*/
+Infill::Infill() {
+}
+
+/*
+*
+*	Fills out with the polygons' hatch lines, in printing order: scanline by scanline, with every
+*	other scanline's lines reversed so that each line starts near where the last one ended
+*
+*/
+void Infill::fill(const vector<Polygon*> *polys, float spacing, float angle, vector<hatch_line> *out) {
+
+	out->clear();
+	if (!(spacing > 0)) return;
+
+	float cos_a = cosf(angle);
+	float sin_a = sinf(angle);
+	build_edge_table(polys, cos_a, sin_a);
+	int num_edges = (int) edges.size();
+	if (!num_edges) return;
+
+	active_y_min.clear();
+	active_y_max.clear();
+	active_x.clear();
+	active_slope.clear();
+
+	int next = 0;
+	int row = (int) ceilf(edges[0].y_min / spacing - 0.5f);
+	bool reverse = false;
+
+	while (true) {
+
+		float y = ((float) row + 0.5f) * spacing;
+		add_edges(&next, y);
+		drop_edges(y);
+
+		// Nothing crosses this scanline: skip to the first one the next edge reaches
+		if (active_x.empty()) {
+			if (next == num_edges) break;
+			row = max(row + 1, (int) ceilf(edges[next].y_min / spacing - 0.5f));
+			continue;
+		}
+
+		get_crossings(y);
+		int num_pairs = (int) crossings.size() / 2;
+		bool emitted = false;
+		for (int p = 0; p < num_pairs; p++) {
+			int q = reverse ? num_pairs - 1 - p : p;
+			float x0 = crossings[2 * q];
+			float x1 = crossings[2 * q + 1];
+			if (x1 - x0 < MIN_HATCH_LENGTH) continue;
+			if (reverse) swap(x0, x1);
+			hatch_line line;
+			line.start.x = x0 * cos_a - y * sin_a;
+			line.start.y = x0 * sin_a + y * cos_a;
+			line.end.x = x1 * cos_a - y * sin_a;
+			line.end.y = x1 * sin_a + y * cos_a;
+			out->push_back(line);
+			emitted = true;
+		}
+		if (emitted) reverse = !reverse;
+		row++;
+
+	}
+
+}
+
+/*
+*
+*	Collects the edges of the closed polygons, rotated by -angle, each running upwards,
+*	sorted by their lowest y. Horizontal edges never cross a scanline and are left out
+*
+*/
+void Infill::build_edge_table(const vector<Polygon*> *polys, float cos_a, float sin_a) {
+
+	edges.clear();
+	int num_polys = (int) polys->size();
+	for (int i = 0; i < num_polys; i++) {
+
+		Polygon *p = (*polys)[i];
+		int n = p->get_size();
+		if (n < 3 || p->is_open()) continue;
+
+		for (int k = 0; k < n; k++) {
+			const vertex<int> *a = &p->vertices[k];
+			const vertex<int> *b = &p->vertices[k + 1 < n ? k + 1 : 0];
+			float ax = (float) a->x * cos_a + (float) a->y * sin_a;
+			float ay = (float) a->y * cos_a - (float) a->x * sin_a;
+			float bx = (float) b->x * cos_a + (float) b->y * sin_a;
+			float by = (float) b->y * cos_a - (float) b->x * sin_a;
+			if (ay == by) continue;
+			if (ay > by) {
+				swap(ax, bx);
+				swap(ay, by);
+			}
+			hatch_edge e;
+			e.y_min = ay;
+			e.y_max = by;
+			e.x = ax;
+			e.slope = (bx - ax) / (by - ay);
+			edges.push_back(e);
+		}
+
+	}
+
+	sort(edges.begin(), edges.end(), [](const hatch_edge &a, const hatch_edge &b) { return a.y_min < b.y_min; });
+
+}
+
+/*
+*
+*	Moves the edges that start at or below y from the edge table to the active list
+*
+*/
+void Infill::add_edges(int *next, float y) {
+	int num_edges = (int) edges.size();
+	while (*next < num_edges && edges[*next].y_min <= y) {
+		const hatch_edge *e = &edges[(*next)++];
+		active_y_min.push_back(e->y_min);
+		active_y_max.push_back(e->y_max);
+		active_x.push_back(e->x);
+		active_slope.push_back(e->slope);
+	}
+}
+
+/*
+*
+*	Drops the active edges that end at or below y. Edges cover [y_min, y_max), so a scanline
+*	through a vertex crosses exactly one of the two edges meeting there if the polygon goes on
+*	past it, and neither or both if it turns back
+*
+*/
+void Infill::drop_edges(float y) {
+	int n = (int) active_x.size();
+	int m = 0;
+	for (int k = 0; k < n; k++) {
+		if (active_y_max[k] <= y) continue;
+		active_y_min[m] = active_y_min[k];
+		active_y_max[m] = active_y_max[k];
+		active_x[m] = active_x[k];
+		active_slope[m] = active_slope[k];
+		m++;
+	}
+	active_y_min.resize(m);
+	active_y_max.resize(m);
+	active_x.resize(m);
+	active_slope.resize(m);
+}
+
+/*
+*
+*	Where the scanline at y crosses each active edge, sorted along the scanline
+*
+*/
+void Infill::get_crossings(float y) {
+	int n = (int) active_x.size();
+	crossings.resize(n);
+	const float *y_min = &active_y_min[0];
+	const float *x = &active_x[0];
+	const float *slope = &active_slope[0];
+	float *out = &crossings[0];
+	for (int k = 0; k < n; k++)
+		out[k] = x[k] + (y - y_min[k]) * slope[k];
+	sort(crossings.begin(), crossings.end());
+}
@@ -0,0 +1,37 @@
+#ifndef INFILL_H
+#define INFILL_H
+
+#include <vector>
+#include "vertex.hpp"
+#include "polygon.hpp"
+
+struct hatch_line {
+	vertex<float> start;
+	vertex<float> end;
+};
+
+struct hatch_edge {
+	float y_min;
+	float y_max;
+	float x;
+	float slope;
+};
+
+class Infill {
+	public:
+		Infill();
+		void fill(const std::vector<Polygon*> *polys, float spacing, float angle, std::vector<hatch_line> *out);
+	private:
+		void build_edge_table(const std::vector<Polygon*> *polys, float cos_a, float sin_a);
+		void add_edges(int *next, float y);
+		void drop_edges(float y);
+		void get_crossings(float y);
+		std::vector<hatch_edge> edges;
+		std::vector<float> active_y_min;
+		std::vector<float> active_y_max;
+		std::vector<float> active_x;
+		std::vector<float> active_slope;
+		std::vector<float> crossings;
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include <assert.h>
+#include "intersect.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+#else
+#define SIMD_WIDTH 1
+#endif
+
+using namespace std;
+
+/*
+*
+*	An Intersector holds a structure-of-arrays copy of a mesh's facets (one array per vertex
+*	coordinate) and cuts batches of them against a plane. With AVX2 it classifies and
+*	interpolates 8 facets per pass, with SSE2 4, and otherwise falls back to scalar code.
+*	Segments come out in the same order and orientation as Slices::get_points produces them.
+*
+*/
+Intersector::Intersector() { num_facets = 0; }
+
+/*
+*
+*	Copies the facets into the SoA arrays in the given order, so that facet ids passed to
+*	intersect are positions in facet_order. Slicing in z-sorted order keeps facets that are
+*	active at the same time close together in memory
+*
+*/
+void Intersector::load(Mesh *mesh, const vector<int> *facet_order) {
+
+	num_facets = (int) facet_order->size();
+	for (int k = 0; k < 9; k++)
+		coords[k].resize(num_facets);
+
+	for (int i = 0; i < num_facets; i++) {
+		facet f;
+		mesh->get_facet((*facet_order)[i], &f);
+		for (int j = 0; j < 3; j++) {
+			coords[j][i] = f.a[j];
+			coords[3 + j][i] = f.b[j];
+			coords[6 + j][i] = f.c[j];
+		}
+	}
+
+}
+
+const char* Intersector::get_isa() {
+#if defined(__AVX2__)
+	return "AVX2";
+#elif defined(__SSE2__)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
+
+/*
+*
+*	Appends the segments where facets ids[0..n) cross the plane at height z to out, two
+*	points per segment
+*
+*/
+void Intersector::intersect(const int *ids, int n, float z, vector<vertex<float> > *out) {
+
+	int i = 0;
+
+#if SIMD_WIDTH > 1
+
+	float d[3][SIMD_WIDTH];
+	float p[6][SIMD_WIDTH];
+	int on[3], below[3];
+
+	for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+
+#if SIMD_WIDTH == 8
+		__m256i idx = _mm256_loadu_si256((const __m256i *) (ids + i));
+		__m256 v[9];
+		for (int k = 0; k < 9; k++)
+			v[k] = _mm256_i32gather_ps(&coords[k][0], idx, 4);
+
+		__m256 zv = _mm256_set1_ps(z);
+		__m256 da = _mm256_sub_ps(v[2], zv);
+		__m256 db = _mm256_sub_ps(v[5], zv);
+		__m256 dc = _mm256_sub_ps(v[8], zv);
+
+		__m256 zero = _mm256_setzero_ps();
+		__m256 dv[3] = { da, db, dc };
+		for (int k = 0; k < 3; k++) {
+			on[k] = _mm256_movemask_ps(_mm256_cmp_ps(dv[k], zero, _CMP_EQ_OQ));
+			below[k] = _mm256_movemask_ps(_mm256_cmp_ps(dv[k], zero, _CMP_LT_OQ));
+		}
+
+		// Interpolation parameters along a->b, b->c and a->c
+		__m256 s_ab = _mm256_div_ps(da, _mm256_sub_ps(da, db));
+		__m256 s_bc = _mm256_div_ps(db, _mm256_sub_ps(db, dc));
+		__m256 s_ac = _mm256_div_ps(da, _mm256_sub_ps(da, dc));
+
+		_mm256_storeu_ps(d[0], da);
+		_mm256_storeu_ps(d[1], db);
+		_mm256_storeu_ps(d[2], dc);
+		for (int k = 0; k < 2; k++) {
+			_mm256_storeu_ps(p[k], _mm256_add_ps(v[k], _mm256_mul_ps(s_ab, _mm256_sub_ps(v[3 + k], v[k]))));
+			_mm256_storeu_ps(p[2 + k], _mm256_add_ps(v[3 + k], _mm256_mul_ps(s_bc, _mm256_sub_ps(v[6 + k], v[3 + k]))));
+			_mm256_storeu_ps(p[4 + k], _mm256_add_ps(v[k], _mm256_mul_ps(s_ac, _mm256_sub_ps(v[6 + k], v[k]))));
+		}
+#else
+		__m128 v[9];
+		for (int k = 0; k < 9; k++)
+			v[k] = _mm_setr_ps(coords[k][ids[i]], coords[k][ids[i + 1]], coords[k][ids[i + 2]], coords[k][ids[i + 3]]);
+
+		__m128 zv = _mm_set1_ps(z);
+		__m128 da = _mm_sub_ps(v[2], zv);
+		__m128 db = _mm_sub_ps(v[5], zv);
+		__m128 dc = _mm_sub_ps(v[8], zv);
+
+		__m128 zero = _mm_setzero_ps();
+		__m128 dv[3] = { da, db, dc };
+		for (int k = 0; k < 3; k++) {
+			on[k] = _mm_movemask_ps(_mm_cmpeq_ps(dv[k], zero));
+			below[k] = _mm_movemask_ps(_mm_cmplt_ps(dv[k], zero));
+		}
+
+		__m128 s_ab = _mm_div_ps(da, _mm_sub_ps(da, db));
+		__m128 s_bc = _mm_div_ps(db, _mm_sub_ps(db, dc));
+		__m128 s_ac = _mm_div_ps(da, _mm_sub_ps(da, dc));
+
+		_mm_storeu_ps(d[0], da);
+		_mm_storeu_ps(d[1], db);
+		_mm_storeu_ps(d[2], dc);
+		for (int k = 0; k < 2; k++) {
+			_mm_storeu_ps(p[k], _mm_add_ps(v[k], _mm_mul_ps(s_ab, _mm_sub_ps(v[3 + k], v[k]))));
+			_mm_storeu_ps(p[2 + k], _mm_add_ps(v[3 + k], _mm_mul_ps(s_bc, _mm_sub_ps(v[6 + k], v[3 + k]))));
+			_mm_storeu_ps(p[4 + k], _mm_add_ps(v[k], _mm_mul_ps(s_ac, _mm_sub_ps(v[6 + k], v[k]))));
+		}
+#endif
+
+		// A facet is cut if exactly two of its corners lie in the plane, or none do and they
+		// aren't all on one side. Only those lanes go on to emit, which never selects a lane's
+		// interpolation that divided by zero
+		int any_on = on[0] | on[1] | on[2];
+		int mixed = (below[0] ^ below[1]) | (below[1] ^ below[2]);
+		int cut = ~(on[0] ^ on[1] ^ on[2]) & (any_on | mixed) & ((1 << SIMD_WIDTH) - 1);
+		if (!cut) continue;
+
+		for (int lane = 0; lane < SIMD_WIDTH; lane++) {
+			if (!((cut >> lane) & 1)) continue;
+			float lane_d[3] = { d[0][lane], d[1][lane], d[2][lane] };
+			float lane_p[6] = { p[0][lane], p[1][lane], p[2][lane], p[3][lane], p[4][lane], p[5][lane] };
+			emit(ids[i + lane], lane_d, lane_p, out);
+		}
+
+	}
+
+#endif
+
+	intersect_scalar(ids + i, n - i, z, out);
+
+}
+
+void Intersector::intersect_scalar(const int *ids, int n, float z, vector<vertex<float> > *out) {
+
+	for (int i = 0; i < n; i++) {
+
+		int id = ids[i];
+		float d[3] = { coords[2][id] - z, coords[5][id] - z, coords[8][id] - z };
+		float s_ab = d[0] / (d[0] - d[1]);
+		float s_bc = d[1] / (d[1] - d[2]);
+		float s_ac = d[0] / (d[0] - d[2]);
+
+		float p[6];
+		for (int k = 0; k < 2; k++) {
+			p[k] = coords[k][id] + s_ab * (coords[3 + k][id] - coords[k][id]);
+			p[2 + k] = coords[3 + k][id] + s_bc * (coords[6 + k][id] - coords[3 + k][id]);
+			p[4 + k] = coords[k][id] + s_ac * (coords[6 + k][id] - coords[k][id]);
+		}
+
+		emit(id, d, p, out);
+
+	}
+
+}
+
+/*
+*
+*	Given the signed distances d of vertices a, b and c from the plane and the interpolated
+*	crossings p along a->b, b->c and a->c, appends the facet's segment (if any) to out, using
+*	the same case analysis as Slices::get_points (a facet wholly on one side of the plane, which
+*	the sweep never hands over, gives no segment rather than a degenerate one)
+*
+*/
+void Intersector::emit(int id, const float *d, const float *p, vector<vertex<float> > *out) {
+
+	int count = 0;
+	if (!d[0]) count++;
+	if (!d[1]) count++;
+	if (!d[2]) count++;
+
+	if (count == 1) return;
+	if (count == 3) return;
+	if (!count && (d[0] < 0) == (d[1] < 0) && (d[1] < 0) == (d[2] < 0)) return;
+
+	vertex<float> start = vertex<float>();
+	vertex<float> end = vertex<float>();
+
+	if (count == 2) {
+
+		// The segment is the edge whose endpoints both lie in the plane
+		int u = d[0] ? 1 : 0;
+		int w = d[2] ? 1 : 2;
+		start.x = coords[3 * u][id];
+		start.y = coords[3 * u + 1][id];
+		end.x = coords[3 * w][id];
+		end.y = coords[3 * w + 1][id];
+
+	} else {
+
+		bool first_pt = true;
+		bool a_below = d[0] < 0, b_below = d[1] < 0, c_below = d[2] < 0;
+
+		if (a_below ^ b_below) {
+			start.x = p[0];
+			start.y = p[1];
+			first_pt = false;
+		}
+
+		if (b_below ^ c_below) {
+			vertex<float> *v = first_pt ? &start : &end;
+			v->x = p[2];
+			v->y = p[3];
+		}
+
+		if (a_below ^ c_below) {
+			end.x = p[4];
+			end.y = p[5];
+		}
+
+	}
+
+	out->push_back(start);
+	out->push_back(end);
+
+}
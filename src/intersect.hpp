@@ -0,0 +1,24 @@
+#ifndef INTERSECT_H
+#define INTERSECT_H
+
+#include <vector>
+#include "mesh.hpp"
+#include "vertex.hpp"
+
+#define KERNEL_SCALAR 0
+#define KERNEL_SIMD 1
+
+class Intersector {
+	public:
+		Intersector();
+		void load(Mesh *mesh, const std::vector<int> *facet_order);
+		void intersect(const int *ids, int n, float z, std::vector<vertex<float> > *out);
+		static const char* get_isa();
+	private:
+		void intersect_scalar(const int *ids, int n, float z, std::vector<vertex<float> > *out);
+		void emit(int id, const float *d, const float *p, std::vector<vertex<float> > *out);
+		std::vector<float> coords[9];
+		int num_facets;
+};
+
+#endif
@@ -1,36 +1,284 @@
 #include <string>
+#include <math.h>
 #include <assert.h>
 
 #include "mesh.hpp"
 #include "slices.hpp"
 #include "renderer.hpp"
+#include "gcode.hpp"
+#include "bench.hpp"
+#include "intersect.hpp"
 
 using namespace std;
 using namespace cv;
 
 const float mesh_scale = 9.0f;
+const float weld_tolerance = 1e-5f;
 const float slice_thickness = 1.0f;
 const int contour_thickness = 1;
 const int dim = 900;
+const float shell_width = 0.4f;
 const int min_area = 0;
 const bool show_path = true;
 
+static int show_single_layer(Slices *s, Renderer *r, GcodeWriter *g, int layer, bool exporting) {
+	if (layer >= s->get_num_planes()) {
+		printf("Layer %d is out of range (the model has %d)\n", layer, s->get_num_planes());
+		return 1;
+	}
+	if (g) {
+		g->write_layer(layer, s->get_layer(layer));
+		if (!g->close()) return 1;
+	}
+	if (exporting) return r->export_layer(layer, s->get_layer(layer), contour_thickness, show_path) ? 0 : 1;
+	if (g) return 0;
+	r->render_layer(layer, s->get_layer(layer), contour_thickness, show_path);
+	waitKey(0);
+	return 0;
+}
+
+/*
+*
+*	Writes out (or shows) every layer once slicing is done. Streamed layers have already been
+*	handed over as they finished, so only the files are finished off
+*
+*/
+static int show_all_layers(Slices *s, Renderer *r, GcodeWriter *g, bool exporting, bool streamed, int num_threads) {
+
+	int status = 0;
+	if (g) {
+		if (!streamed) {
+			printf("Writing G-code...\n");
+			for (int i = 0; i < s->get_num_planes(); i++)
+				g->write_layer(i, s->get_layer(i));
+		}
+		if (!g->close()) {
+			printf("Couldn't write the G-code\n");
+			status = 1;
+		}
+	}
+
+	if (exporting) {
+		if (!streamed) printf("Exporting...\n");
+		if ((!streamed && !r->export_layers(contour_thickness, show_path, num_threads)) || !r->end_export()) {
+			printf("Couldn't write every image\n");
+			status = 1;
+		}
+	} else if (!g && !streamed) {
+		printf("Rendering...\n");
+		r->render(contour_thickness, show_path);
+	}
+
+	return status;
+
+}
+
 int main(int argc, char *argv[]) {
 	
+	if (argc < 2) {
+		printf("Usage: %s <model.stl> [--bench] [--chain] [--sweep] [--simd] [--weld] [--edge-cache] [--incremental] [--threads <n>] [--improve <passes>] [--improve-ms <ms>] [--simplify <dp|vw>] [--stream <layers>] [--out-of-core <MB>] [--layer <n>] [--cache <dir>] [--export <dir>] [--gcode <file>] [--arcs] [--infill <mm>] [--infill-angle <degrees>] [--infill-alternate] [--shells <n>]\n", argv[0]);
+		return 1;
+	}
+
 	string filename = string(argv[1]);
+	bool bench = false;
+	int contour_engine = CONTOUR_RASTER;
+	bool sweep = false;
+	int kernel = KERNEL_SCALAR;
+	bool weld = false;
+	bool edge_cache = false;
+	bool incremental = false;
+	int num_threads = 0;
+	int improve_passes = 0;
+	double improve_ms = 0;
+	int simplify_algorithm = SIMPLIFY_DOUGLAS_PEUCKER;
+	bool stream = false;
+	int stream_layers = 0;
+	int out_of_core_mb = 0;
+	int layer = -1;
+	string cache_dir;
+	string export_dir;
+	string gcode_file;
+	bool arcs = false;
+	float infill_spacing = 0;
+	float infill_angle = 45.0f;
+	bool infill_alternate = false;
+	int shells = 0;
+
+	for (int i = 2; i < argc; i++) {
+		string arg = string(argv[i]);
+		if (arg == "--bench") bench = true;
+		else if (arg == "--chain") contour_engine = CONTOUR_CHAIN;
+		else if (arg == "--sweep") sweep = true;
+		else if (arg == "--simd") {
+			sweep = true;
+			kernel = KERNEL_SIMD;
+		} else if (arg == "--weld") {
+			weld = true;
+		} else if (arg == "--edge-cache") {
+			sweep = true;
+			weld = true;
+			edge_cache = true;
+		} else if (arg == "--incremental") {
+			incremental = true;
+		} else if (arg == "--threads" && i + 1 < argc) {
+			num_threads = atoi(argv[++i]);
+		} else if (arg == "--improve" && i + 1 < argc) {
+			improve_passes = atoi(argv[++i]);
+		} else if (arg == "--improve-ms" && i + 1 < argc) {
+			improve_ms = atof(argv[++i]);
+		} else if (arg == "--simplify" && i + 1 < argc && string(argv[i + 1]) == "dp") {
+			simplify_algorithm = SIMPLIFY_DOUGLAS_PEUCKER;
+			i++;
+		} else if (arg == "--simplify" && i + 1 < argc && string(argv[i + 1]) == "vw") {
+			simplify_algorithm = SIMPLIFY_VISVALINGAM;
+			i++;
+		} else if (arg == "--stream" && i + 1 < argc) {
+			stream = true;
+			sweep = true;
+			stream_layers = atoi(argv[++i]);
+		} else if (arg == "--out-of-core" && i + 1 < argc) {
+			sweep = true;
+			out_of_core_mb = atoi(argv[++i]);
+		} else if (arg == "--layer" && i + 1 < argc) {
+			layer = atoi(argv[++i]);
+		} else if (arg == "--cache" && i + 1 < argc) {
+			cache_dir = string(argv[++i]);
+		} else if (arg == "--export" && i + 1 < argc) {
+			export_dir = string(argv[++i]);
+		} else if (arg == "--gcode" && i + 1 < argc) {
+			gcode_file = string(argv[++i]);
+		} else if (arg == "--arcs") {
+			arcs = true;
+		} else if (arg == "--infill" && i + 1 < argc) {
+			infill_spacing = (float) atof(argv[++i]);
+		} else if (arg == "--infill-angle" && i + 1 < argc) {
+			infill_angle = (float) atof(argv[++i]);
+		} else if (arg == "--infill-alternate") {
+			infill_alternate = true;
+		} else if (arg == "--shells" && i + 1 < argc) {
+			shells = atoi(argv[++i]);
+		}
+		else {
+			printf("Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
 
-	printf("Loading mesh...\n");
-	Mesh m;
-	assert(m.load_STL(filename));
-	m.scale_mesh(mesh_scale);
+	// Slicing a single layer needs the whole mesh in memory
+	if (layer >= 0 && out_of_core_mb > 0) {
+		printf("--layer can't be combined with --out-of-core\n");
+		return 1;
+	}
+
+	if (bench) {
+		run_benchmarks(filename);
+		return 0;
+	}
 
-	printf("Slicing...\n");
 	Slices s;
-	s.make_slices(&m, slice_thickness, dim, min_area);
+	s.set_contour_engine(contour_engine);
+	s.set_sweep(sweep);
+	s.set_kernel(kernel);
+	s.set_edge_cache(edge_cache);
+	s.set_incremental(incremental);
+	s.set_num_threads(num_threads);
+	s.set_tour_budget(improve_passes, improve_ms);
+	s.set_simplifier(simplify_algorithm);
+	s.set_infill(infill_spacing * mesh_scale, infill_angle * (float) M_PI / 180.0f, infill_alternate);
+	s.set_shells(shells, shell_width * mesh_scale);
 
-	printf("Rendering...\n");
 	Renderer r(&s); 
-	r.render(contour_thickness, show_path);
+	bool exporting = !export_dir.empty();
+	if (exporting && !r.begin_export(export_dir)) {
+		printf("Couldn't create %s\n", export_dir.c_str());
+		return 1;
+	}
+
+	// Layers are in pixels, and the mesh was scaled by mesh_scale from mm
+	GcodeWriter gcode;
+	GcodeWriter *g = NULL;
+	if (!gcode_file.empty()) {
+		if (!gcode.open(gcode_file, dim, slice_thickness, 1.0f / mesh_scale)) {
+			printf("Couldn't create %s\n", gcode_file.c_str());
+			return 1;
+		}
+		gcode.set_arcs(arcs);
+		g = &gcode;
+	}
+	bool headless = exporting || g;
+
+	// The cache key covers the mesh file's bytes and every setting that changes the slices
+	SliceCache cache(cache_dir);
+	if (!cache_dir.empty()) {
+		uint64_t key;
+		if (!SliceCache::hash_file(filename, &key)) {
+			printf("Couldn't read %s\n", filename.c_str());
+			return 1;
+		}
+		float mesh_params[3] = { mesh_scale, slice_thickness, weld ? weld_tolerance : -1.0f };
+		int slice_params[3] = { dim, min_area, out_of_core_mb };
+		key = SliceCache::hash(mesh_params, sizeof(mesh_params), key);
+		key = SliceCache::hash(slice_params, sizeof(slice_params), key);
+		key = s.get_settings_hash(key);
+
+		if (cache.open(key)) {
+			printf("Loading cached slices...\n");
+			s.load_cache(&cache);
+			if (layer >= 0) return show_single_layer(&s, &r, g, layer, exporting);
+			if (stream && !headless) {
+				for (int i = 0; i < s.get_num_planes(); i++)
+					r.render_layer(i, s.get_layer(i), contour_thickness, show_path);
+				return 0;
+			}
+			return show_all_layers(&s, &r, g, exporting, false, num_threads);
+		}
+		s.set_cache(&cache);
+	}
+
+	if (stream) {
+		// Layers are written and shown one at a time, in order; exported images are encoded a
+		// batch at a time, in parallel
+		batch_sink export_batch;
+		if (exporting) {
+			export_batch = [&r, num_threads](int first_plane, vector<Polygons*> *layers) {
+				r.export_batch(first_plane, layers, contour_thickness, show_path, num_threads);
+			};
+		}
+		s.set_streaming(stream_layers, [&r, g, headless](int plane_index, Polygons *layer) {
+			if (g) g->write_layer(plane_index, layer);
+			if (!headless) r.render_layer(plane_index, layer, contour_thickness, show_path);
+		}, export_batch);
+	}
+	if (out_of_core_mb > 0) {
+		printf("Splitting mesh into bands...\n");
+		Bands bands;
+		if (weld) bands.set_weld(weld_tolerance);
+		if (!bands.split(filename, mesh_scale, slice_thickness, (size_t) out_of_core_mb << 20)) {
+			printf("Couldn't split %s\n", filename.c_str());
+			return 1;
+		}
+		printf("Slicing %d bands...\n", bands.get_num_bands());
+		s.make_slices(&bands, dim, min_area);
+	} else {
+		printf("Loading mesh...\n");
+		Mesh m;
+		if (!m.load_STL(filename)) {
+			printf("Couldn't load %s\n", filename.c_str());
+			return 1;
+		}
+		if (weld) m.weld(weld_tolerance);
+		m.scale_mesh(mesh_scale);
+		if (layer >= 0) {
+			s.prepare_layers(&m, slice_thickness, dim, min_area);
+			printf("Slicing layer %d...\n", layer);
+			return show_single_layer(&s, &r, g, layer, exporting);
+		}
+		printf("Slicing...\n");
+		s.make_slices(&m, slice_thickness, dim, min_area);
+	}
+
+	return show_all_layers(&s, &r, g, exporting, stream, num_threads);
 	
 }
 
@@ -1,11 +1,29 @@
 #include <limits>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
 #include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "mesh.hpp"
+#include "parallel.hpp"
+
+#define STL_HEADER_SIZE 84
+#define STL_FACET_SIZE 50
+#define WELD_SHARDS_PER_THREAD 4
+#define WELD_MAX_CELL (1 << 24)
+#define WELD_RAW_TAG (1LL << 40)
 
 using namespace std;
 
 Mesh::Mesh() {
 	num_facets = 0;
+	num_threads = get_num_threads(0);
 	mesh = NULL;
 
 	for (int i = 0; i < 3; i++) {
@@ -19,77 +37,545 @@ Mesh::Mesh() {
 *	Takes an STL file as input and generates a triangle mesh
 *	Each triangle face is represented by a facet struct
 *
+*	The file is memory-mapped rather than read facet by facet, and the facets are decoded
+*	straight into the mesh array by several threads, each of which also tracks the bounds
+*	of its own chunk so that no second pass over the mesh is needed
+*
 **/
-int Mesh::load_STL(string filename) {
+int Mesh::load_STL(string filename, int _num_threads) {
 	
-	ifstream stl_file;
-	stl_file.open(filename, ios::in | ios::binary);
-	if (!stl_file) return 0;
+	num_threads = get_num_threads(_num_threads);
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return 0;
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) < 0 || file_stat.st_size < STL_HEADER_SIZE) {
+		close(fd);
+		return 0;
+	}
+
+	size_t file_size = (size_t) file_stat.st_size;
+	void *file_map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (file_map == MAP_FAILED) return 0;
+	madvise(file_map, file_size, MADV_WILLNEED);
+
+	// The facet count is a little-endian uint32, and the file must be large enough to hold that many facets
+	const char *data = (const char *) file_map;
+	uint32_t facets_raw;
+	memcpy(&facets_raw, data + 80, 4);
+	if (!facets_raw || facets_raw > (uint32_t) numeric_limits<int>::max() ||
+		(file_size - STL_HEADER_SIZE) / STL_FACET_SIZE < facets_raw) {
+		munmap(file_map, file_size);
+		return 0;
+	}
 
-	long facets_raw;
-	stl_file.seekg(80, ios::beg);
-	stl_file.read((char *)&facets_raw, 4);
 	num_facets = (int) facets_raw;
+	z_index.clear();
+	vertices.clear();
+	indices.clear();
+	facet_edges.clear();
+	edge_vertices.clear();
+	delete[] mesh;
 	mesh = new facet[num_facets];
-	if (!mesh) return 0;
-	
-	get_facets(&stl_file);
-	get_bounds();
+
+	get_facets(data + STL_HEADER_SIZE);
+	munmap(file_map, file_size);
+
+	update_shift();
 	center_mesh();
 	
 	return 1;
 
 }
 
-void Mesh::get_facets(ifstream *file_p) {
-	for (int i = 0; i < num_facets; i++) {
-		file_p->seekg(12, ios::cur);
-		file_p->read((char *)mesh[i].a, 12);
-		file_p->read((char *)mesh[i].b, 12);
-		file_p->read((char *)mesh[i].c, 12);
-		file_p->seekg(2, ios::cur);
+/*
+*
+*	Reads count facets, already centered in the model's coordinates, from a spill file (see
+*	Bands) into the mesh. The facets aren't centered again, so that every band of a model keeps
+*	the coordinates of the whole
+*
+*/
+int Mesh::load_facets(FILE *file, int count) {
+
+	z_index.clear();
+	vertices.clear();
+	indices.clear();
+	facet_edges.clear();
+	edge_vertices.clear();
+	delete[] mesh;
+	mesh = NULL;
+	num_facets = 0;
+	if (count <= 0) return 0;
+
+	mesh = new facet[count];
+	if (fread(mesh, sizeof(facet), (size_t) count, file) != (size_t) count) {
+		delete[] mesh;
+		mesh = NULL;
+		return 0;
 	}
+
+	num_facets = count;
+	get_bounds();
+	return 1;
+
 }
 
-void Mesh::get_bounds() {
-	
-	for (int i = 0; i < num_facets; i++) {
-		for (int j = 0; j < 3; j++) {	
-			if (mesh[i].a[j] < mesh_bounds[j][0]) mesh_bounds[j][0] = mesh[i].a[j];
-			if (mesh[i].b[j] < mesh_bounds[j][0]) mesh_bounds[j][0] = mesh[i].b[j];
-			if (mesh[i].c[j] < mesh_bounds[j][0]) mesh_bounds[j][0] = mesh[i].c[j];
-			if (mesh[i].a[j] > mesh_bounds[j][1]) mesh_bounds[j][1] = mesh[i].a[j];
-			if (mesh[i].b[j] > mesh_bounds[j][1]) mesh_bounds[j][1] = mesh[i].b[j];
-			if (mesh[i].c[j] > mesh_bounds[j][1]) mesh_bounds[j][1] = mesh[i].c[j];
+/*
+*
+*	Decodes the facet records that follow the STL header, skipping each facet's normal and
+*	attribute byte count, and returns the bounds of the decoded vertices
+*
+*/
+void Mesh::get_facets(const char *data) {
+
+	vector<float> thread_bounds(6 * num_threads);
+	for (int t = 0; t < num_threads; t++) init_bounds(&thread_bounds[6 * t]);
+
+	parallel_for(num_facets, num_threads, [&](int begin, int end, int thread) {
+		float *b = &thread_bounds[6 * thread];
+		for (int i = begin; i < end; i++) {
+			memcpy((void *) mesh[i].a, (const void *) (data + (size_t) i * STL_FACET_SIZE + 12), (size_t) 36);
+			add_bounds(&mesh[i], b);
 		}
+	});
+
+	merge_bounds(&thread_bounds[0]);
+
+}
+
+/*
+*
+*	Reduces the per-thread bounds (laid out as min/max pairs for x, y and z) into mesh_bounds.
+*	Threads that were never handed a chunk still hold the initial max/lowest values, so they
+*	drop out of the reduction naturally
+*
+*/
+void Mesh::merge_bounds(const float *thread_bounds) {
+	for (int j = 0; j < 3; j++) {
+		mesh_bounds[j][0] = numeric_limits<float>::max();
+		mesh_bounds[j][1] = numeric_limits<float>::lowest();
 	}
+	for (int t = 0; t < num_threads; t++) {
+		for (int j = 0; j < 3; j++) {
+			mesh_bounds[j][0] = min(mesh_bounds[j][0], thread_bounds[6*t + 2*j]);
+			mesh_bounds[j][1] = max(mesh_bounds[j][1], thread_bounds[6*t + 2*j + 1]);
+		}
+	}
+}
+
+void Mesh::init_bounds(float *b) {
+	for (int j = 0; j < 3; j++) {
+		b[2*j] = numeric_limits<float>::max();
+		b[2*j + 1] = numeric_limits<float>::lowest();
+	}
+}
+
+void Mesh::add_bounds(const facet *f, float *b) {
+	for (int j = 0; j < 3; j++) {
+		b[2*j] = min(b[2*j], min(f->a[j], min(f->b[j], f->c[j])));
+		b[2*j + 1] = max(b[2*j + 1], max(f->a[j], max(f->b[j], f->c[j])));
+	}
+}
 
+void Mesh::add_bounds(const float *v, float *b) {
+	for (int j = 0; j < 3; j++) {
+		b[2*j] = min(b[2*j], v[j]);
+		b[2*j + 1] = max(b[2*j + 1], v[j]);
+	}
+}
+
+void Mesh::get_bounds() {
+
+	vector<float> thread_bounds(6 * num_threads);
+	for (int t = 0; t < num_threads; t++) init_bounds(&thread_bounds[6 * t]);
+
+	if (is_indexed()) {
+		parallel_for(get_numVertices(), num_threads, [&](int begin, int end, int thread) {
+			float *b = &thread_bounds[6 * thread];
+			for (int i = begin; i < end; i++)
+				add_bounds(&vertices[3 * i], b);
+		});
+	} else {
+		parallel_for(num_facets, num_threads, [&](int begin, int end, int thread) {
+			float *b = &thread_bounds[6 * thread];
+			for (int i = begin; i < end; i++)
+				add_bounds(&mesh[i], b);
+		});
+	}
+
+	merge_bounds(&thread_bounds[0]);
+	update_shift();
+}
+
+void Mesh::update_shift() {
 	mesh_shift[0] = (mesh_bounds[0][1] + mesh_bounds[0][0]) / 2.0f;
 	mesh_shift[1] = (mesh_bounds[1][1] + mesh_bounds[1][0]) / 2.0f;
 	mesh_shift[2] = mesh_bounds[2][0];
 }
 
 void Mesh::scale_mesh(float scale) {
-	assert(num_facets && mesh);
-	for (int i = 0; i < num_facets; i++) {
-		for (int j = 0; j < 3; j++) {
-			mesh[i].a[j] *= scale;
-			mesh[i].b[j] *= scale;
-			mesh[i].c[j] *= scale;	
-		}
-	}
+	assert(num_facets && (mesh || is_indexed()));
+	float no_shift[3] = { 0.0f, 0.0f, 0.0f };
+	transform(scale, no_shift);
 	get_bounds();
 }
 
 void Mesh::center_mesh() {
+	float shift[3] = { mesh_shift[0], mesh_shift[1], mesh_shift[2] };
+	transform(1.0f, shift);
+	get_bounds();
+}
+
+/*
+*
+*	Applies v = v * scale - shift to every vertex, in whichever representation the mesh is
+*	currently stored
+*
+*/
+void Mesh::transform(float scale, const float *shift) {
+	z_index.clear();
+	if (is_indexed()) {
+		parallel_for(get_numVertices(), num_threads, [&](int begin, int end, int thread) {
+			for (int i = begin; i < end; i++) {
+				for (int j = 0; j < 3; j++)
+					vertices[3*i + j] = vertices[3*i + j] * scale - shift[j];
+			}
+		});
+	} else {
+		parallel_for(num_facets, num_threads, [&](int begin, int end, int thread) {
+			for (int i = begin; i < end; i++) {
+				for (int j = 0; j < 3; j++) {
+					mesh[i].a[j] = mesh[i].a[j] * scale - shift[j];
+					mesh[i].b[j] = mesh[i].b[j] * scale - shift[j];
+					mesh[i].c[j] = mesh[i].c[j] * scale - shift[j];
+				}
+			}
+		});
+	}
+}
+
+/*
+*
+*	Quantized vertex position used as the weld key: the index of the tolerance-wide cell each
+*	coordinate falls in. With a zero tolerance, or a coordinate too large for its cell index to
+*	be exact (where floats are already further apart than the tolerance), the raw float bits
+*	are used instead, tagged so they can't be mistaken for a cell index
+*
+*/
+struct weld_key {
+	int64_t q[3];
+	bool operator==(const weld_key &o) const { return q[0] == o.q[0] && q[1] == o.q[1] && q[2] == o.q[2]; }
+};
+
+struct weld_hash {
+	size_t operator()(const weld_key &k) const {
+		uint64_t h = (uint64_t) k.q[0] * 0x9E3779B97F4A7C15ULL;
+		h ^= (uint64_t) k.q[1] * 0xC2B2AE3D27D4EB4FULL;
+		h ^= (uint64_t) k.q[2] * 0x165667B19E3779F9ULL;
+		return (size_t) (h ^ (h >> 29));
+	}
+};
+
+static weld_key get_weld_key(const float *v, float tolerance) {
+	weld_key k;
+	for (int j = 0; j < 3; j++) {
+		double cell = tolerance > 0 ? floor((double) v[j] / tolerance + 0.5) : 0;
+		if (tolerance > 0 && fabs(cell) < WELD_MAX_CELL) {
+			k.q[j] = (int64_t) cell;
+		} else {
+			uint32_t bits;
+			memcpy(&bits, &v[j], 4);
+			k.q[j] = WELD_RAW_TAG + bits;
+		}
+	}
+	return k;
+}
+
+static int find_root(vector<int> *parent, int v) {
+	while ((*parent)[v] != v) {
+		(*parent)[v] = (*parent)[(*parent)[v]];
+		v = (*parent)[v];
+	}
+	return v;
+}
+
+/*
+*
+*	Vertices within tolerance of each other can still round into neighbouring cells, so each
+*	welded vertex is compared with the vertices of the cells next to its own (half of them, so
+*	each pair is compared once), and those within tolerance are merged into the lower id
+*
+*/
+static void merge_neighbour_cells(vector<int> *indices, const vector<float> *vertices, const vector<weld_key> *vertex_keys, float tolerance, int num_threads) {
+
+	int num_vertices = (int) vertex_keys->size();
+	unordered_map<weld_key, int, weld_hash> ids;
+	ids.reserve(num_vertices);
+	for (int v = 0; v < num_vertices; v++)
+		ids[(*vertex_keys)[v]] = v;
+
+	vector<vector<pair<int, int> > > merges(num_threads);
+	double max_dist = (double) tolerance * tolerance;
+	parallel_for(num_vertices, num_threads, [&](int begin, int end, int thread) {
+		for (int v = begin; v < end; v++) {
+			const weld_key *k = &(*vertex_keys)[v];
+			for (int d = 14; d < 27; d++) {
+				int offset[3] = { d / 9 - 1, (d / 3) % 3 - 1, d % 3 - 1 };
+				weld_key n = *k;
+				bool exact = false;
+				for (int j = 0; j < 3; j++) {
+					if (k->q[j] >= WELD_RAW_TAG && offset[j]) exact = true;
+					n.q[j] += offset[j];
+				}
+				if (exact) continue;
+				unordered_map<weld_key, int, weld_hash>::const_iterator it = ids.find(n);
+				if (it == ids.end()) continue;
+				const float *a = &(*vertices)[3 * (size_t) v];
+				const float *b = &(*vertices)[3 * (size_t) it->second];
+				double dist = 0;
+				for (int j = 0; j < 3; j++)
+					dist += ((double) a[j] - b[j]) * ((double) a[j] - b[j]);
+				if (dist <= max_dist) merges[thread].push_back(make_pair(v, it->second));
+			}
+		}
+	});
+
+	vector<int> parent(num_vertices);
+	for (int v = 0; v < num_vertices; v++)
+		parent[v] = v;
+	for (int t = 0; t < num_threads; t++) {
+		for (int m = 0; m < (int) merges[t].size(); m++) {
+			int a = find_root(&parent, merges[t][m].first);
+			int b = find_root(&parent, merges[t][m].second);
+			if (a != b) parent[max(a, b)] = min(a, b);
+		}
+	}
+
+	int num_corners = (int) indices->size();
+	parallel_for(num_corners, num_threads, [&](int begin, int end, int thread) {
+		for (int i = begin; i < end; i++) {
+			int v = (*indices)[i];
+			while (parent[v] != v) v = parent[v];
+			(*indices)[i] = v;
+		}
+	});
+
+}
+
+/*
+*
+*	Converts the facet array into an indexed mesh: a buffer of unique vertices plus three
+*	vertex indices per triangle. Corners are hashed into shards by their quantized position,
+*	each shard is deduplicated independently by one thread, and the shards' vertices are then
+*	laid out one after another. Vertices that landed in neighbouring cells but are within
+*	tolerance of each other are then merged too. The facet array is released afterwards, so
+*	each shared vertex is stored once instead of once per adjacent facet.
+*
+*/
+void Mesh::weld(float tolerance) {
+
+	if (is_indexed() || !num_facets) return;
+	z_index.clear();
+
+	int num_corners = 3 * num_facets;
+	int num_shards = num_threads * WELD_SHARDS_PER_THREAD;
+	const float *corners = mesh[0].a;
+
+	// Hash every corner and count how many corners each thread sends to each shard
+	vector<weld_key> keys(num_corners);
+	vector<int> shard_of(num_corners);
+	vector<int> shard_counts(num_threads * num_shards, 0);
+	parallel_for(num_corners, num_threads, [&](int begin, int end, int thread) {
+		weld_hash hasher;
+		for (int i = begin; i < end; i++) {
+			keys[i] = get_weld_key(&corners[3 * i], tolerance);
+			shard_of[i] = (int) (hasher(keys[i]) % num_shards);
+			shard_counts[thread * num_shards + shard_of[i]]++;
+		}
+	});
+
+	// Lay the shards out contiguously; within a shard, corners keep their original order
+	vector<int> shard_start(num_shards + 1, 0);
+	vector<int> write_pos(num_threads * num_shards);
+	int pos = 0;
+	for (int s = 0; s < num_shards; s++) {
+		shard_start[s] = pos;
+		for (int t = 0; t < num_threads; t++) {
+			write_pos[t * num_shards + s] = pos;
+			pos += shard_counts[t * num_shards + s];
+		}
+	}
+	shard_start[num_shards] = pos;
+
+	vector<int> shard_corners(num_corners);
+	parallel_for(num_corners, num_threads, [&](int begin, int end, int thread) {
+		int *w = &write_pos[thread * num_shards];
+		for (int i = begin; i < end; i++)
+			shard_corners[w[shard_of[i]]++] = i;
+	});
+
+	// Deduplicate each shard, storing shard-local vertex ids in the index buffer for now
+	indices.resize(num_corners);
+	vector<int> shard_unique(num_shards + 1, 0);
+	vector<vector<int> > shard_firsts(num_shards);
+	parallel_for(num_shards, num_threads, [&](int begin, int end, int thread) {
+		for (int s = begin; s < end; s++) {
+			unordered_map<weld_key, int, weld_hash> ids;
+			ids.reserve(shard_start[s + 1] - shard_start[s]);
+			for (int i = shard_start[s]; i < shard_start[s + 1]; i++) {
+				int c = shard_corners[i];
+				pair<unordered_map<weld_key, int, weld_hash>::iterator, bool> ins = ids.insert(make_pair(keys[c], (int) shard_firsts[s].size()));
+				if (ins.second) shard_firsts[s].push_back(c);
+				indices[c] = ins.first->second;
+			}
+			shard_unique[s] = (int) shard_firsts[s].size();
+		}
+	});
+
+	vector<int> shard_offset(num_shards + 1, 0);
+	for (int s = 0; s < num_shards; s++)
+		shard_offset[s + 1] = shard_offset[s] + shard_unique[s];
+
+	// Each vertex takes the position of the first corner that mapped to it
+	vertices.resize(3 * (size_t) shard_offset[num_shards]);
+	parallel_for(num_shards, num_threads, [&](int begin, int end, int thread) {
+		for (int s = begin; s < end; s++) {
+			for (int v = 0; v < shard_unique[s]; v++)
+				memcpy(&vertices[3 * (size_t) (shard_offset[s] + v)], &corners[3 * shard_firsts[s][v]], 12);
+		}
+	});
+
+	parallel_for(num_corners, num_threads, [&](int begin, int end, int thread) {
+		for (int i = begin; i < end; i++)
+			indices[i] += shard_offset[shard_of[i]];
+	});
+
+	int num_vertices = shard_offset[num_shards];
+	if (tolerance > 0) {
+		vector<weld_key> vertex_keys(num_vertices);
+		parallel_for(num_shards, num_threads, [&](int begin, int end, int thread) {
+			for (int s = begin; s < end; s++) {
+				for (int v = 0; v < shard_unique[s]; v++)
+					vertex_keys[shard_offset[s] + v] = keys[shard_firsts[s][v]];
+			}
+		});
+		merge_neighbour_cells(&indices, &vertices, &vertex_keys, tolerance, num_threads);
+	}
+
+	// Renumber vertices in order of first use, so that neighbouring facets share cache lines
+	// (and vertices merged away above are dropped)
+	vector<int> new_id(num_vertices, -1);
+	int next_id = 0;
+	for (int i = 0; i < num_corners; i++) {
+		if (new_id[indices[i]] < 0) new_id[indices[i]] = next_id++;
+		indices[i] = new_id[indices[i]];
+	}
+	vector<float> ordered(3 * (size_t) next_id);
+	parallel_for(num_vertices, num_threads, [&](int begin, int end, int thread) {
+		for (int v = begin; v < end; v++)
+			if (new_id[v] >= 0) memcpy(&ordered[3 * (size_t) new_id[v]], &vertices[3 * (size_t) v], 12);
+	});
+	vertices.swap(ordered);
+
+	delete[] mesh;
+	mesh = NULL;
+
+}
+
+/*
+*
+*	Assigns an id to every distinct edge of the indexed mesh. facet_edges holds three edge ids
+*	per facet, for its a-b, b-c and a-c edges in that order, and edge_vertices holds the two
+*	vertex indices of each edge, lower index first, so both facets sharing an edge see it with
+*	the same orientation
+*
+*/
+void Mesh::build_edges() {
+
+	assert(is_indexed());
+	if (!facet_edges.empty()) return;
+
+	const int corner_pairs[3][2] = { { 0, 1 }, { 1, 2 }, { 0, 2 } };
+	unordered_map<uint64_t, int> edge_ids;
+	edge_ids.reserve(3 * (size_t) num_facets / 2);
+	facet_edges.resize(3 * (size_t) num_facets);
+
 	for (int i = 0; i < num_facets; i++) {
-		for (int j = 0; j < 3; j++) {	
-			mesh[i].a[j] -= mesh_shift[j];
-			mesh[i].b[j] -= mesh_shift[j];
-			mesh[i].c[j] -= mesh_shift[j];	
+		for (int k = 0; k < 3; k++) {
+			int u = indices[3*i + corner_pairs[k][0]];
+			int v = indices[3*i + corner_pairs[k][1]];
+			if (u > v) swap(u, v);
+			uint64_t key = ((uint64_t) (uint32_t) u << 32) | (uint32_t) v;
+			pair<unordered_map<uint64_t, int>::iterator, bool> ins = edge_ids.insert(make_pair(key, (int) edge_vertices.size() / 2));
+			if (ins.second) {
+				edge_vertices.push_back(u);
+				edge_vertices.push_back(v);
+			}
+			facet_edges[3*i + k] = ins.first->second;
 		}
 	}
-	get_bounds();
+
+}
+
+int Mesh::get_numEdges() { return (int) edge_vertices.size() / 2; }
+
+/*
+*
+*	Builds the interval index over the facets' z-ranges (see ZIndex), if it isn't built yet.
+*	Moving the mesh (scale_mesh, weld, loading) drops the index
+*
+*/
+void Mesh::build_z_index() {
+
+	if (z_index.is_built()) return;
+
+	vector<float> z_min(num_facets);
+	vector<float> z_max(num_facets);
+	parallel_for(num_facets, num_threads, [&](int begin, int end, int thread) {
+		for (int i = begin; i < end; i++) {
+			facet curr;
+			get_facet(i, &curr);
+			z_min[i] = min(curr.a[2], min(curr.b[2], curr.c[2]));
+			z_max[i] = max(curr.a[2], max(curr.b[2], curr.c[2]));
+		}
+	});
+
+	z_index.build(&z_min, &z_max);
+
+}
+
+/*
+*
+*	Appends the index of every facet whose z-range overlaps [z_lo, z_hi] to out
+*
+*/
+void Mesh::get_facets_at(float z_lo, float z_hi, vector<int> *out) {
+	build_z_index();
+	z_index.query(z_lo, z_hi, out);
+}
+
+bool Mesh::is_indexed() { return !indices.empty(); }
+
+/*
+*
+*	Copies facet i into out, regardless of whether the mesh is stored as facets or indexed
+*
+*/
+void Mesh::get_facet(int i, facet *out) {
+	if (is_indexed()) {
+		memcpy(out->a, &vertices[3 * (size_t) indices[3*i]], 12);
+		memcpy(out->b, &vertices[3 * (size_t) indices[3*i + 1]], 12);
+		memcpy(out->c, &vertices[3 * (size_t) indices[3*i + 2]], 12);
+	} else {
+		*out = mesh[i];
+	}
+}
+
+int Mesh::get_numVertices() {
+	if (is_indexed()) return (int) (vertices.size() / 3);
+	return 3 * num_facets;
 }
 
 int Mesh::get_numFacets() {
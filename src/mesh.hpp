@@ -4,6 +4,9 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <stdio.h>
+#include "zindex.hpp"
 
 struct facet {
 	float a[3];
@@ -14,18 +17,39 @@ struct facet {
 class Mesh {
 	public:
 		Mesh();
-		int load_STL(std::string filename);
+		int load_STL(std::string filename, int num_threads = 0);
+		int load_facets(FILE *file, int count);
 		int get_numFacets();
+		int get_numVertices();
 		void scale_mesh(float f);
+		void weld(float tolerance);
+		void build_edges();
+		bool is_indexed();
+		int get_numEdges();
+		void build_z_index();
+		void get_facets_at(float z_lo, float z_hi, std::vector<int> *out);
+		void get_facet(int i, facet *out);
 		~Mesh();
 		facet *mesh;
+		std::vector<float> vertices;
+		std::vector<int> indices;
+		std::vector<int> facet_edges;
+		std::vector<int> edge_vertices;
 		float mesh_bounds[3][2];
 	private:
-		void get_facets(std::ifstream *stl_file);
+		void get_facets(const char *data);
 		void get_bounds();
+		void init_bounds(float *b);
+		void add_bounds(const facet *f, float *b);
+		void add_bounds(const float *v, float *b);
+		void transform(float scale, const float *shift);
+		void merge_bounds(const float *thread_bounds);
+		void update_shift();
 		void center_mesh();
 		int num_facets;
+		int num_threads;
 		float mesh_shift[3];
+		ZIndex z_index;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,741 @@
+#include <math.h>
+#include <algorithm>
+#include "offset.hpp"
+
+#define OFFSET_SCALE 1024
+#define OFFSET_ARC_TOLERANCE 0.25
+#define OFFSET_QUERY 0.25L
+#define MIN_OFFSET_AREA 1.0
+#define MIN_OFFSET_POINTS 3
+#define OFFSET_SPLIT_PASSES 8
+
+using namespace std;
+
+static int64_t orient(const vertex<int64_t> *a, const vertex<int64_t> *b, const vertex<int64_t> *c) {
+	return (b->x - a->x) * (c->y - a->y) - (b->y - a->y) * (c->x - a->x);
+}
+
+static int get_sign(int64_t v) {
+	return (v > 0) - (v < 0);
+}
+
+static bool on_segment(const vertex<int64_t> *a, const vertex<int64_t> *b, const vertex<int64_t> *c) {
+	return c->x >= min(a->x, b->x) && c->x <= max(a->x, b->x) && c->y >= min(a->y, b->y) && c->y <= max(a->y, b->y);
+}
+
+static long double get_x_at(const offset_edge *e, long double y) {
+	return e->a.x + (e->b.x - e->a.x) * (y - e->a.y) / (e->b.y - e->a.y);
+}
+
+static bool same_point(const vertex<int64_t> *a, const vertex<int64_t> *b) {
+	return a->x == b->x && a->y == b->y;
+}
+
+/*
+*
+*	An Offsetter moves the outlines of a layer's closed polygons inwards by given distances in
+*	pixels (or outwards, for negative distances), working on their vertices. The outlines are
+*	scaled to a fixed-point grid and first united even-odd, which untangles outlines that touch
+*	or share edges and turns each so the region it bounds lies along its normal. Every edge is
+*	then pushed along that normal, with convex corners rounded by arcs and concave ones joined
+*	back through the original vertex, as in Clipper. The raw offset edges overlap and cross
+*	wherever the outline was narrower than the offset; they are split at each crossing (found
+*	by sweeping horizontal bands), and only the pieces with positive winding on one side and
+*	none on the other are kept and traced into rings. Islands that split apart or grow together
+*	and holes that close up fall out of that union. The work depends on the number of vertices
+*	and on how many edges cross a band, not on the area the polygons cover
+*
+*/
+Offsetter::Offsetter() {
+	band_y = 0;
+	band_height = 1;
+}
+
+/*
+*
+*	Fills (*out)[k] with the outlines offset by (*distances)[k], rounded to the polygons' pixel
+*	coordinates. Each ring repeats its first point at the end, since a Polygon drops the first
+*	point of the contour it is built from
+*
+*/
+void Offsetter::offset(const vector<Polygon*> *polys, const vector<float> *distances, vector<vector<vector<cv::Point> > > *out) {
+
+	int num_offsets = (int) distances->size();
+	out->assign(num_offsets, vector<vector<cv::Point> >());
+
+	get_rings(polys);
+	if (rings.empty()) return;
+
+	// Shrinking by one distance and then another is the same as shrinking by their sum (and
+	// likewise for growing), so the insets are taken in increasing order, then the outsets,
+	// each from the one before. Every step then only moves the outline a little, and the raw
+	// edges cross far less than they would offsetting the whole way from the outline
+	vector<int> order(num_offsets);
+	for (int k = 0; k < num_offsets; k++) order[k] = k;
+	sort(order.begin(), order.end(), [distances](int i, int j) {
+		float a = (*distances)[i];
+		float b = (*distances)[j];
+		if ((a < 0) != (b < 0)) return b < 0;
+		return fabsf(a) < fabsf(b);
+	});
+
+	float last = 0;
+	last_rings = rings;
+	for (int i = 0; i < num_offsets; i++) {
+		int k = order[i];
+		float d = (*distances)[k];
+		if (i > 0 && (d < 0) != (last < 0)) {
+			last = 0;
+			last_rings = rings;
+		}
+
+		edges.clear();
+		for (int r = 0; r < (int) last_rings.size(); r++)
+			add_raw_offset(&last_rings[r], (d - last) * OFFSET_SCALE);
+		unite(false, &offset_rings);
+		last_rings.swap(offset_rings);
+		last = d;
+
+		vector<vector<cv::Point> > *contours = &(*out)[k];
+		for (int r = 0; r < (int) last_rings.size(); r++) {
+			vector<cv::Point> contour;
+			contour.reserve(last_rings[r].size() + 1);
+			for (int j = 0; j < (int) last_rings[r].size(); j++) {
+				const vertex<int64_t> *v = &last_rings[r][j];
+				cv::Point pt((int) llround((double) v->x / OFFSET_SCALE), (int) llround((double) v->y / OFFSET_SCALE));
+				if (!contour.empty() && contour.back() == pt) continue;
+				contour.push_back(pt);
+			}
+			while (contour.size() > 1 && contour.back() == contour.front()) contour.pop_back();
+			if ((int) contour.size() < MIN_OFFSET_POINTS) continue;
+			if (cv::contourArea(contour) < MIN_OFFSET_AREA) continue;
+
+			contour.push_back(contour.front());
+			contours->push_back(contour);
+		}
+	}
+
+}
+
+/*
+*
+*	Copies the closed polygons onto the fixed-point grid and unites them even-odd into rings,
+*	each turned so the region it bounds lies along its edges' normals
+*
+*/
+void Offsetter::get_rings(const vector<Polygon*> *polys) {
+
+	edges.clear();
+	vector<vertex<int64_t> > ring;
+	for (int i = 0; i < (int) polys->size(); i++) {
+		Polygon *p = (*polys)[i];
+		if (p->get_size() < 3 || p->is_open()) continue;
+
+		ring.clear();
+		for (int k = 0; k < p->get_size(); k++) {
+			vertex<int64_t> v = {(int64_t) p->vertices[k].x * OFFSET_SCALE, (int64_t) p->vertices[k].y * OFFSET_SCALE};
+			if (!ring.empty() && same_point(&ring.back(), &v)) continue;
+			ring.push_back(v);
+		}
+		add_ring(&ring);
+	}
+	unite(true, &rings);
+
+}
+
+void Offsetter::add_ring(const vector<vertex<int64_t> > *ring) {
+	int n = (int) ring->size();
+	while (n > 1 && same_point(&(*ring)[n - 1], &(*ring)[0])) n--;
+	if (n < 3) return;
+	for (int k = 0; k < n; k++) {
+		offset_edge e = {(*ring)[k], (*ring)[(k + 1) % n], 1};
+		edges.push_back(e);
+	}
+}
+
+/*
+*
+*	Adds the edges of one ring pushed along their normals by distance (in grid units). A corner
+*	that opens away from the offset gets an arc, within OFFSET_ARC_TOLERANCE pixels of the true
+*	circle; one that folds into it is joined through the original vertex, leaving a small loop
+*	that the union removes. Shallow corners, and corners whose edges are long enough for their
+*	offsets to meet, are mitered instead
+*
+*/
+void Offsetter::add_raw_offset(const vector<vertex<int64_t> > *ring, double distance) {
+
+	int n = (int) ring->size();
+	vector<double> nx(n);
+	vector<double> ny(n);
+	vector<double> len(n);
+	for (int k = 0; k < n; k++) {
+		const vertex<int64_t> *a = &(*ring)[k];
+		const vertex<int64_t> *b = &(*ring)[(k + 1) % n];
+		double dx = (double) (b->x - a->x);
+		double dy = (double) (b->y - a->y);
+		len[k] = hypot(dx, dy);
+		nx[k] = dy / len[k];
+		ny[k] = -dx / len[k];
+	}
+
+	double tolerance = OFFSET_ARC_TOLERANCE * OFFSET_SCALE;
+	double radius = fabs(distance);
+	double step = radius > tolerance ? 2 * acos(1 - tolerance / radius) : M_PI;
+
+	// How far a miter would cut into the edges either side of each corner that folds in
+	vector<double> trim(n);
+	for (int i = 0; i < n; i++) {
+		int j = (i + n - 1) % n;
+		double cross = nx[j] * ny[i] - ny[j] * nx[i];
+		double dot = nx[j] * nx[i] + ny[j] * ny[i];
+		trim[i] = cross * distance < 0 && dot > 0 ? radius * tan(fabs(atan2(cross, dot)) / 2) : 0;
+	}
+
+	vector<vertex<int64_t> > raw;
+	raw.reserve(n * 2);
+	for (int i = 0; i < n; i++) {
+		int j = (i + n - 1) % n;
+		double vx = (double) (*ring)[i].x;
+		double vy = (double) (*ring)[i].y;
+		double cross = nx[j] * ny[i] - ny[j] * nx[i];
+		double dot = nx[j] * nx[i] + ny[j] * ny[i];
+		double angle = atan2(cross, dot);
+		bool opening = cross * distance > 0;
+
+		// Where the two offset edges meet, if that's within an arc step, or if neither edge
+		// runs out before they do on a corner that folds in
+		bool miter = dot > 0 && (opening ? fabs(angle) < step : trim[j] + trim[i] <= len[j] && trim[i] + trim[(i + 1) % n] <= len[i]);
+		if (miter) {
+			add_point(&raw, vx + distance * (nx[j] + nx[i]) / (1 + dot), vy + distance * (ny[j] + ny[i]) / (1 + dot));
+		} else if (opening || fabs(cross) < 1e-9) {
+			if (fabs(cross) < 1e-9) angle = distance > 0 ? M_PI : -M_PI;
+			int steps = max(1, (int) ceil(fabs(angle) / step));
+			for (int s = 0; s <= steps; s++) {
+				double a = angle * s / steps;
+				double rx = nx[j] * cos(a) - ny[j] * sin(a);
+				double ry = nx[j] * sin(a) + ny[j] * cos(a);
+				add_point(&raw, vx + distance * rx, vy + distance * ry);
+			}
+		} else {
+			add_point(&raw, vx + distance * nx[j], vy + distance * ny[j]);
+			add_point(&raw, vx, vy);
+			add_point(&raw, vx + distance * nx[i], vy + distance * ny[i]);
+		}
+	}
+	add_ring(&raw);
+
+}
+
+void Offsetter::add_point(vector<vertex<int64_t> > *raw, double x, double y) {
+	vertex<int64_t> v = {llround(x), llround(y)};
+	if (!raw->empty() && same_point(&raw->back(), &v)) return;
+	raw->push_back(v);
+}
+
+/*
+*
+*	Replaces edges with the rings bounding the region they fill, either by positive winding
+*	or, with even_odd, by odd winding
+*
+*/
+void Offsetter::unite(bool even_odd, vector<vector<vertex<int64_t> > > *out) {
+	out->clear();
+	if (edges.empty()) return;
+	split_edges();
+	merge_edges(even_odd);
+	trace_rings(even_odd, out);
+}
+
+/*
+*
+*	Splits every edge wherever it crosses or touches another, so that edges only meet at their
+*	ends. Rounding a crossing to the grid bends the edges through it a little, which can make
+*	them cross edges they used to miss, so the pieces of every edge that was split are checked
+*	again, until nothing more is split (snap rounding). Edges that weren't split have already
+*	been checked against each other
+*
+*/
+void Offsetter::split_edges() {
+	parents.resize(edges.size());
+	for (int i = 0; i < (int) edges.size(); i++) parents[i] = i;
+	for (int pass = 0; pass < OFFSET_SPLIT_PASSES; pass++) {
+		find_splits();
+		if (splits.empty()) return;
+		cut_edges();
+	}
+}
+
+/*
+*
+*	Finds where the edges cross or touch, for every pair where at least one edge has a parent
+*	(is new since the last pass) and the two aren't pieces of the same edge. Each band sorts the
+*	edges passing through it by their x range there and tests the pairs that overlap; a crossing
+*	is only reported by the band it falls in. Bands without a new edge are skipped
+*
+*/
+void Offsetter::find_splits() {
+
+	build_bands();
+	splits.clear();
+
+	for (int b = 0; b < (int) bands.size(); b++) {
+		bool any_new = false;
+		for (int k = 0; k < (int) bands[b].size() && !any_new; k++) any_new = parents[bands[b][k]] >= 0;
+		if (!any_new) continue;
+
+		double y0 = (double) (band_y + b * band_height);
+		double y1 = y0 + band_height;
+		spans.clear();
+		for (int k = 0; k < (int) bands[b].size(); k++) {
+			int i = bands[b][k];
+			const offset_edge *e = &edges[i];
+			offset_span span;
+			if (e->a.y == e->b.y) {
+				span.x0 = min(e->a.x, e->b.x);
+				span.x1 = max(e->a.x, e->b.x);
+			} else {
+				// Where the edge enters and leaves the band, widened past any rounding
+				double slope = (double) (e->b.x - e->a.x) / (double) (e->b.y - e->a.y);
+				double xa = e->a.x + slope * (max(y0, (double) min(e->a.y, e->b.y)) - e->a.y);
+				double xb = e->a.x + slope * (min(y1, (double) max(e->a.y, e->b.y)) - e->a.y);
+				span.x0 = (int64_t) min(xa, xb) - 1;
+				span.x1 = (int64_t) max(xa, xb) + 1;
+			}
+			span.x0--;
+			span.x1++;
+			span.edge = i;
+			spans.push_back(span);
+		}
+		sort(spans.begin(), spans.end(), [](const offset_span &p, const offset_span &q) {
+			return p.x0 < q.x0 || (p.x0 == q.x0 && p.edge < q.edge);
+		});
+		for (int k = 0; k < (int) spans.size(); k++) {
+			int i = spans[k].edge;
+			for (int l = k + 1; l < (int) spans.size() && spans[l].x0 <= spans[k].x1; l++) {
+				int j = spans[l].edge;
+				if (parents[i] != parents[j] && (parents[i] >= 0 || parents[j] >= 0)) split_pair(i, j, b);
+			}
+		}
+	}
+
+}
+
+/*
+*
+*	Cuts each edge into pieces at its splits, ordered from a to b. The pieces of an edge that
+*	was split get it as their parent; those of the pieces that weren't get none (-1). The pieces
+*	of one edge run along it in order, so they never cross each other
+*
+*/
+void Offsetter::cut_edges() {
+
+	sort(splits.begin(), splits.end(), [this](const pair<int, vertex<int64_t> > &p, const pair<int, vertex<int64_t> > &q) {
+		if (p.first != q.first) return p.first < q.first;
+		const offset_edge *e = &edges[p.first];
+		int64_t dx = e->b.x - e->a.x;
+		int64_t dy = e->b.y - e->a.y;
+		return (p.second.x - q.second.x) * dx + (p.second.y - q.second.y) * dy < 0;
+	});
+
+	vector<offset_edge> pieces;
+	pieces.reserve(edges.size() + splits.size());
+	parents.clear();
+	int s = 0;
+	for (int i = 0; i < (int) edges.size(); i++) {
+		vertex<int64_t> from = edges[i].a;
+		int parent = s < (int) splits.size() && splits[s].first == i ? i : -1;
+		for (; s < (int) splits.size() && splits[s].first == i; s++) {
+			if (same_point(&splits[s].second, &from)) continue;
+			offset_edge e = {from, splits[s].second, edges[i].winding};
+			pieces.push_back(e);
+			parents.push_back(parent);
+			from = splits[s].second;
+		}
+		if (same_point(&edges[i].b, &from)) continue;
+		offset_edge e = {from, edges[i].b, edges[i].winding};
+		pieces.push_back(e);
+		parents.push_back(parent);
+	}
+	edges.swap(pieces);
+
+}
+
+/*
+*
+*	Finds where edges i and j cross or touch using exact orientation tests, and splits both
+*	there. A crossing point is rounded to the grid
+*
+*/
+void Offsetter::split_pair(int i, int j, int band) {
+
+	const vertex<int64_t> *a = &edges[i].a;
+	const vertex<int64_t> *b = &edges[i].b;
+	const vertex<int64_t> *c = &edges[j].a;
+	const vertex<int64_t> *d = &edges[j].b;
+	int o1 = get_sign(orient(a, b, c));
+	int o2 = get_sign(orient(a, b, d));
+	int o3 = get_sign(orient(c, d, a));
+	int o4 = get_sign(orient(c, d, b));
+
+	if (o1 * o2 > 0 || o3 * o4 > 0) return;
+
+	if (o1 * o2 < 0 && o3 * o4 < 0) {
+		long double t = (long double) orient(c, d, a) / ((long double) orient(c, d, a) - (long double) orient(c, d, b));
+		long double x = a->x + t * (b->x - a->x);
+		long double y = a->y + t * (b->y - a->y);
+		if (get_pair_band(i, j, y) != band) return;
+		vertex<int64_t> p = {llroundl(x), llroundl(y)};
+		add_split(i, &p);
+		add_split(j, &p);
+		return;
+	}
+
+	// An end of one edge lying on the other (edges joined end to end need no split)
+	if (o1 == 0 && !same_point(c, a) && !same_point(c, b) && on_segment(a, b, c) && get_pair_band(i, j, c->y) == band) add_split(i, c);
+	if (o2 == 0 && !same_point(d, a) && !same_point(d, b) && on_segment(a, b, d) && get_pair_band(i, j, d->y) == band) add_split(i, d);
+	if (o3 == 0 && !same_point(a, c) && !same_point(a, d) && on_segment(c, d, a) && get_pair_band(i, j, a->y) == band) add_split(j, a);
+	if (o4 == 0 && !same_point(b, c) && !same_point(b, d) && on_segment(c, d, b) && get_pair_band(i, j, b->y) == band) add_split(j, b);
+
+}
+
+void Offsetter::add_split(int edge, const vertex<int64_t> *p) {
+	if (same_point(p, &edges[edge].a) || same_point(p, &edges[edge].b)) return;
+	splits.push_back(make_pair(edge, *p));
+}
+
+/*
+*
+*	Joins the pieces that run between the same two points, adding up their windings (or, with
+*	even_odd, counting them in either direction), and drops those that cancel out
+*
+*/
+void Offsetter::merge_edges(bool even_odd) {
+
+	// Number the distinct end points by sorting them
+	int num_pieces = (int) edges.size();
+	ends.resize(2 * num_pieces);
+	for (int i = 0; i < num_pieces; i++) {
+		ends[2 * i] = make_pair(get_key(&edges[i].a), 2 * i);
+		ends[2 * i + 1] = make_pair(get_key(&edges[i].b), 2 * i + 1);
+	}
+	sort(ends.begin(), ends.end());
+	nodes.clear();
+	end_nodes.resize(2 * num_pieces);
+	for (int k = 0; k < 2 * num_pieces; k++) {
+		int end = ends[k].second;
+		if (k == 0 || ends[k].first != ends[k - 1].first)
+			nodes.push_back(end % 2 ? edges[end / 2].b : edges[end / 2].a);
+		end_nodes[end] = (int) nodes.size() - 1;
+	}
+
+	// Then gather the pieces by the pair of points they join
+	pairs.clear();
+	for (int i = 0; i < num_pieces; i++) {
+		int from = end_nodes[2 * i];
+		int to = end_nodes[2 * i + 1];
+		if (from == to) continue;
+		int winding = from < to || even_odd ? edges[i].winding : -edges[i].winding;
+		uint64_t key = ((uint64_t) min(from, to) << 32) | (uint32_t) max(from, to);
+		pairs.push_back(make_pair(key, winding));
+	}
+	sort(pairs.begin(), pairs.end());
+
+	edges.clear();
+	edge_from.clear();
+	edge_to.clear();
+	for (int k = 0; k < (int) pairs.size(); ) {
+		uint64_t key = pairs[k].first;
+		int winding = 0;
+		for (; k < (int) pairs.size() && pairs[k].first == key; k++) winding += pairs[k].second;
+		if (even_odd) winding &= 1;
+		if (winding == 0) continue;
+
+		int from = (int) (key >> 32);
+		int to = (int) (key & 0xffffffff);
+		offset_edge e = {nodes[from], nodes[to], winding};
+		edges.push_back(e);
+		edge_from.push_back(from);
+		edge_to.push_back(to);
+	}
+
+}
+
+uint64_t Offsetter::get_key(const vertex<int64_t> *p) {
+	return ((uint64_t) (uint32_t) p->x << 32) | (uint32_t) p->y;
+}
+
+/*
+*
+*	Sorts the edges into horizontal bands about as tall as an average edge, so a ray or a sweep
+*	only has to look at the edges near it
+*
+*/
+void Offsetter::build_bands() {
+
+	int64_t y0 = edges[0].a.y;
+	int64_t y1 = y0;
+	int64_t total = 0;
+	for (int i = 0; i < (int) edges.size(); i++) {
+		y0 = min(y0, min(edges[i].a.y, edges[i].b.y));
+		y1 = max(y1, max(edges[i].a.y, edges[i].b.y));
+		total += llabs(edges[i].b.y - edges[i].a.y);
+	}
+
+	int64_t num_edges = (int64_t) edges.size();
+	band_y = y0;
+	band_height = max((int64_t) 1, total / num_edges);
+	band_height = max(band_height, (y1 - y0) / (num_edges * 4) + 1);
+	int num_bands = (int) ((y1 - y0) / band_height) + 1;
+
+	bands.resize(num_bands);
+	for (int b = 0; b < num_bands; b++) bands[b].clear();
+	for (int i = 0; i < (int) edges.size(); i++) {
+		int first, last;
+		get_band_range(&edges[i], &first, &last);
+		for (int b = first; b <= last; b++) bands[b].push_back(i);
+	}
+
+}
+
+int Offsetter::get_band(long double y) {
+	long double b = floorl((y - band_y) / band_height);
+	if (b < 0) return 0;
+	if (b >= (long double) bands.size()) return (int) bands.size() - 1;
+	return (int) b;
+}
+
+void Offsetter::get_band_range(const offset_edge *e, int *first, int *last) {
+	int64_t num_bands = (int64_t) bands.size();
+	*first = (int) min((min(e->a.y, e->b.y) - band_y) / band_height, num_bands - 1);
+	*last = (int) min((max(e->a.y, e->b.y) - band_y) / band_height, num_bands - 1);
+}
+
+/*
+*
+*	Returns the band at y, clamped to the bands edges i and j share, so that the sweep reports
+*	each point where they meet exactly once
+*
+*/
+int Offsetter::get_pair_band(int i, int j, long double y) {
+	int first_i, last_i, first_j, last_j;
+	get_band_range(&edges[i], &first_i, &last_i);
+	get_band_range(&edges[j], &first_j, &last_j);
+	return min(max(get_band(y), max(first_i, first_j)), min(last_i, last_j));
+}
+
+/*
+*
+*	Returns the winding number at (x, y): the windings of the edges crossing the horizontal
+*	line through it to its left, counted up for edges running down (+y) and down for the rest.
+*	y must not lie on the grid. The edge skip is left out
+*
+*/
+int Offsetter::get_winding(long double x, long double y, int skip) {
+
+	int winding = 0;
+	vector<int> *band = &bands[get_band(y)];
+	for (int k = 0; k < (int) band->size(); k++) {
+		int i = (*band)[k];
+		const offset_edge *e = &edges[i];
+		if (i == skip) continue;
+		if (e->a.y == e->b.y) continue;
+		if (y <= min(e->a.y, e->b.y) || y >= max(e->a.y, e->b.y)) continue;
+		if (get_x_at(e, y) < x) winding += e->b.y > e->a.y ? e->winding : -e->winding;
+	}
+	return winding;
+
+}
+
+/*
+*
+*	Returns the winding on the side of edge away from its normal (dy, -dx), from a ray cast just
+*	off the grid. The side along the normal winds higher by the edge's own winding
+*
+*/
+int Offsetter::get_outer_winding(int edge) {
+	const offset_edge *e = &edges[edge];
+	if (e->a.y != e->b.y) {
+		long double y = (e->a.y + e->b.y) / 2.0L + OFFSET_QUERY;
+		int left = get_winding(get_x_at(e, y), y, edge);
+		return e->b.y > e->a.y ? left : left - e->winding;
+	}
+	long double x = (e->a.x + e->b.x) / 2.0L;
+	return get_winding(x, e->a.y + (e->b.x > e->a.x ? OFFSET_QUERY : -OFFSET_QUERY), -1);
+}
+
+/*
+*
+*	Fills outer_windings for every edge. Going round a point, the winding changes by each edge's
+*	winding as the edges leaving it are passed, so once one edge at a point is known the rest
+*	follow, and only one ray per connected group of edges has to be cast
+*
+*/
+void Offsetter::find_windings() {
+
+	build_bands();
+
+	int num_edges = (int) edges.size();
+	int num_nodes = (int) nodes.size();
+	node_first.assign(num_nodes + 1, 0);
+	for (int i = 0; i < num_edges; i++) {
+		node_first[edge_from[i] + 1]++;
+		node_first[edge_to[i] + 1]++;
+	}
+	for (int n = 0; n < num_nodes; n++) node_first[n + 1] += node_first[n];
+	node_edges.resize(2 * num_edges);
+	vector<int> fill(node_first.begin(), node_first.end() - 1);
+	for (int i = 0; i < num_edges; i++) {
+		node_edges[fill[edge_from[i]]++] = i;
+		node_edges[fill[edge_to[i]]++] = i;
+	}
+
+	// Sort the edges leaving each point by angle, exactly
+	for (int n = 0; n < num_nodes; n++) {
+		sort(node_edges.begin() + node_first[n], node_edges.begin() + node_first[n + 1], [this, n](int i, int j) {
+			const vertex<int64_t> *p = &nodes[n];
+			const vertex<int64_t> *q = &nodes[get_other_end(i, n)];
+			const vertex<int64_t> *r = &nodes[get_other_end(j, n)];
+			int64_t ux = q->x - p->x, uy = q->y - p->y;
+			int64_t vx = r->x - p->x, vy = r->y - p->y;
+			bool lower_u = uy < 0 || (uy == 0 && ux < 0);
+			bool lower_v = vy < 0 || (vy == 0 && vx < 0);
+			if (lower_u != lower_v) return !lower_u;
+			return ux * vy - uy * vx > 0;
+		});
+	}
+
+	outer_windings.assign(num_edges, 0);
+	vector<bool> known(num_edges, false);
+	vector<bool> visited(num_nodes, false);
+	vector<int> queue;
+	for (int s = 0; s < num_edges; s++) {
+		if (known[s]) continue;
+		outer_windings[s] = get_outer_winding(s);
+		known[s] = true;
+		queue.clear();
+		queue.push_back(edge_from[s]);
+		queue.push_back(edge_to[s]);
+
+		while (!queue.empty()) {
+			int n = queue.back();
+			queue.pop_back();
+			if (visited[n]) continue;
+			visited[n] = true;
+
+			int first = node_first[n];
+			int degree = node_first[n + 1] - first;
+			int k = 0;
+			while (!known[node_edges[first + k]]) k++;
+
+			// The winding just before the known edge, going round n
+			int i = node_edges[first + k];
+			int winding = edge_from[i] == n ? outer_windings[i] + edges[i].winding : outer_windings[i];
+			for (int j = 0; j < degree; j++) {
+				i = node_edges[first + (k + j) % degree];
+				bool leaving = edge_from[i] == n;
+				if (!known[i]) {
+					outer_windings[i] = leaving ? winding - edges[i].winding : winding;
+					known[i] = true;
+					queue.push_back(get_other_end(i, n));
+				}
+				winding += leaving ? -edges[i].winding : edges[i].winding;
+			}
+		}
+	}
+
+}
+
+int Offsetter::get_other_end(int edge, int node) {
+	return edge_from[edge] == node ? edge_to[edge] : edge_from[edge];
+}
+
+/*
+*
+*	Keeps the edges with the region filled on exactly one side, turned so that side lies along
+*	their normal (dy, -dx), and follows them into rings. Where several leave the same point, the
+*	ring takes the sharpest turn towards that side, so regions that only touch at a point stay
+*	apart
+*
+*/
+void Offsetter::trace_rings(bool even_odd, vector<vector<vertex<int64_t> > > *out) {
+
+	find_windings();
+
+	kept_from.clear();
+	kept_to.clear();
+	for (int i = 0; i < (int) edges.size(); i++) {
+		const offset_edge *e = &edges[i];
+		int outer = outer_windings[i];
+		int inner = outer + e->winding;
+		bool inner_filled = even_odd ? (inner & 1) != 0 : inner > 0;
+		bool outer_filled = even_odd ? (outer & 1) != 0 : outer > 0;
+		if (inner_filled == outer_filled) continue;
+
+		int from = edge_from[i];
+		int to = edge_to[i];
+		if (!inner_filled) swap(from, to);
+		kept_from.push_back(from);
+		kept_to.push_back(to);
+	}
+
+	int num_kept = (int) kept_from.size();
+	int num_nodes = (int) nodes.size();
+	vector<int> first_out(num_nodes + 1, 0);
+	for (int i = 0; i < num_kept; i++) first_out[kept_from[i] + 1]++;
+	for (int n = 0; n < num_nodes; n++) first_out[n + 1] += first_out[n];
+	vector<int> outgoing(num_kept);
+	vector<int> fill(first_out.begin(), first_out.end() - 1);
+	for (int i = 0; i < num_kept; i++) outgoing[fill[kept_from[i]]++] = i;
+
+	vector<bool> used(num_kept, false);
+	vector<int> ring;
+	for (int s = 0; s < num_kept; s++) {
+		if (used[s]) continue;
+
+		// A trace that runs into a dead end instead of getting back to its start is kept as it
+		// is, closed straight back, rather than losing that part of the outline
+		ring.clear();
+		int cur = s;
+		while (true) {
+			used[cur] = true;
+			ring.push_back(kept_from[cur]);
+			int node = kept_to[cur];
+			if (node == kept_from[s]) break;
+
+			const vertex<int64_t> *p = &nodes[kept_from[cur]];
+			const vertex<int64_t> *q = &nodes[node];
+			double ux = (double) (q->x - p->x);
+			double uy = (double) (q->y - p->y);
+			int next = -1;
+			double best_turn = 0;
+			for (int k = first_out[node]; k < first_out[node + 1]; k++) {
+				int c = outgoing[k];
+				if (used[c]) continue;
+				const vertex<int64_t> *r = &nodes[kept_to[c]];
+				double vx = (double) (r->x - q->x);
+				double vy = (double) (r->y - q->y);
+				double turn = atan2(ux * vy - uy * vx, ux * vx + uy * vy);
+				if (next < 0 || turn < best_turn) {
+					next = c;
+					best_turn = turn;
+				}
+			}
+			if (next < 0) break;
+			cur = next;
+		}
+
+		// Drop the points the ring runs straight through, left by splits
+		out->push_back(vector<vertex<int64_t> >());
+		vector<vertex<int64_t> > *traced = &out->back();
+		int n = (int) ring.size();
+		for (int k = 0; k < n; k++) {
+			const vertex<int64_t> *prev = &nodes[ring[(k + n - 1) % n]];
+			const vertex<int64_t> *v = &nodes[ring[k]];
+			const vertex<int64_t> *next = &nodes[ring[(k + 1) % n]];
+			bool forward = (v->x - prev->x) * (next->x - v->x) + (v->y - prev->y) * (next->y - v->y) > 0;
+			if (orient(prev, v, next) == 0 && forward) continue;
+			traced->push_back(*v);
+		}
+	}
+
+}
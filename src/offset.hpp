@@ -0,0 +1,71 @@
+#ifndef OFFSET_H
+#define OFFSET_H
+
+#include <vector>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "vertex.hpp"
+#include "polygon.hpp"
+
+struct offset_edge {
+	vertex<int64_t> a;
+	vertex<int64_t> b;
+	int winding;
+};
+
+struct offset_span {
+	int64_t x0;
+	int64_t x1;
+	int edge;
+};
+
+class Offsetter {
+	public:
+		Offsetter();
+		void offset(const std::vector<Polygon*> *polys, const std::vector<float> *distances, std::vector<std::vector<std::vector<cv::Point> > > *out);
+	private:
+		void get_rings(const std::vector<Polygon*> *polys);
+		void add_ring(const std::vector<vertex<int64_t> > *ring);
+		void add_raw_offset(const std::vector<vertex<int64_t> > *ring, double distance);
+		void add_point(std::vector<vertex<int64_t> > *raw, double x, double y);
+		void unite(bool even_odd, std::vector<std::vector<vertex<int64_t> > > *out);
+		void split_edges();
+		void find_splits();
+		void cut_edges();
+		void split_pair(int i, int j, int band);
+		void add_split(int edge, const vertex<int64_t> *p);
+		void merge_edges(bool even_odd);
+		void build_bands();
+		int get_band(long double y);
+		void get_band_range(const offset_edge *e, int *first, int *last);
+		int get_pair_band(int i, int j, long double y);
+		int get_winding(long double x, long double y, int skip);
+		int get_outer_winding(int edge);
+		void find_windings();
+		int get_other_end(int edge, int node);
+		void trace_rings(bool even_odd, std::vector<std::vector<vertex<int64_t> > > *out);
+		uint64_t get_key(const vertex<int64_t> *p);
+		std::vector<std::vector<vertex<int64_t> > > rings;
+		std::vector<std::vector<vertex<int64_t> > > last_rings;
+		std::vector<std::vector<vertex<int64_t> > > offset_rings;
+		std::vector<offset_edge> edges;
+		std::vector<std::vector<int> > bands;
+		int64_t band_y;
+		int64_t band_height;
+		std::vector<std::pair<int, vertex<int64_t> > > splits;
+		std::vector<int> parents;
+		std::vector<offset_span> spans;
+		std::vector<vertex<int64_t> > nodes;
+		std::vector<std::pair<uint64_t, int> > ends;
+		std::vector<int> end_nodes;
+		std::vector<std::pair<uint64_t, int> > pairs;
+		std::vector<int> edge_from;
+		std::vector<int> edge_to;
+		std::vector<int> node_first;
+		std::vector<int> node_edges;
+		std::vector<int> outer_windings;
+		std::vector<int> kept_from;
+		std::vector<int> kept_to;
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <thread>
+#include <vector>
+#include <atomic>
+
+/*
+*
+*	Returns the number of worker threads to use when the caller asks for 0 (i.e. "as many as
+*	the machine has")
+*
+*/
+inline int get_num_threads(int requested) {
+	if (requested > 0) return requested;
+	int hw = (int) std::thread::hardware_concurrency();
+	return hw > 0 ? hw : 1;
+}
+
+/*
+*
+*	Splits [0, n) into one contiguous chunk per thread and calls f(begin, end, thread_index)
+*	for each chunk. The calling thread handles the first chunk itself.
+*
+*/
+template <typename F>
+void parallel_for(int n, int num_threads, F f) {
+
+	num_threads = get_num_threads(num_threads);
+	if (num_threads > n) num_threads = n;
+	if (num_threads <= 1) {
+		if (n > 0) f(0, n, 0);
+		return;
+	}
+
+	int chunk = (n + num_threads - 1) / num_threads;
+	std::vector<std::thread> workers;
+	for (int t = 1; t < num_threads; t++) {
+		int begin = t * chunk;
+		int end = begin + chunk < n ? begin + chunk : n;
+		if (begin >= end) break;
+		workers.push_back(std::thread(f, begin, end, t));
+	}
+
+	f(0, chunk < n ? chunk : n, 0);
+	for (int t = 0; t < (int) workers.size(); t++)
+		workers[t].join();
+
+}
+
+/*
+*
+*	Calls f(i, thread_index) for every i in [0, n), with idle threads pulling the next index
+*	from a shared counter. Suits loops whose iterations vary a lot in cost (e.g. one per layer),
+*	where fixed chunks would leave most threads waiting on the slowest one. Iterations must
+*	not depend on each other; results should be written to slot i so the order they finish in
+*	doesn't matter.
+*
+*/
+template <typename F>
+void parallel_for_each(int n, int num_threads, F f) {
+
+	num_threads = get_num_threads(num_threads);
+	if (num_threads > n) num_threads = n;
+	if (num_threads <= 1) {
+		for (int i = 0; i < n; i++) f(i, 0);
+		return;
+	}
+
+	std::atomic<int> next(0);
+	auto work = [&](int t) {
+		for (int i = next++; i < n; i = next++) f(i, t);
+	};
+
+	std::vector<std::thread> workers;
+	for (int t = 1; t < num_threads; t++)
+		workers.push_back(std::thread(work, t));
+
+	work(0);
+	for (int t = 0; t < (int) workers.size(); t++)
+		workers[t].join();
+
+}
+
+#endif
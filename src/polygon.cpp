@@ -1,6 +1,7 @@
 #include <math.h>
 #include <assert.h>
 #include "polygon.hpp"
+#include "simplify.hpp"
 #include <limits>
 
 #define MAX_DIST 5
@@ -17,22 +18,34 @@ using namespace std;
 
 Polygon::Polygon(std::vector<cv::Point> *contour) {
 	int n = (int) contour->size();
+	if (n > 1) vertices.resize(n - 1);
 	for (int i = 1; i < n; i++) {
-		vertex<int> *v = new vertex<int>();
-		v->x = (*contour)[i].x;
-		v->y = (*contour)[i].y;
-		vertices.push_back(v);
+		vertices[i - 1].x = (*contour)[i].x;
+		vertices[i - 1].y = (*contour)[i].y;
 	}
 	start_index = end_index = -1;
 	update_bounds();
 }
 
+/*
+*
+*	Restores a finished polygon (e.g. from a SliceCache): its vertices, already smoothed, and
+*	its entry and exit vertices
+*
+*/
+Polygon::Polygon(const vertex<int> *_vertices, int n, int _start_index, int _end_index) {
+	vertices.assign(_vertices, _vertices + n);
+	start_index = _start_index;
+	end_index = _end_index;
+	update_bounds();
+}
+
 bool Polygon::is_open() {
-	double dist = get_dist(vertices[0], vertices[(int) vertices.size() - 1]);
+	double dist = get_dist(&vertices[0], &vertices[(int) vertices.size() - 1]);
 	return dist > MAX_DIST;
 }
 
-double Polygon::get_dist(vertex<int> *a, vertex<int> *b) {
+double Polygon::get_dist(const vertex<int> *a, const vertex<int> *b) {
 	double x_dist = (double) (a->x - b->x);
 	double y_dist = (double) (a->y - b->y);
 	x_dist *= x_dist;
@@ -43,49 +56,38 @@ double Polygon::get_dist(vertex<int> *a, vertex<int> *b) {
 /*
 *	
 *	Converts chains of contiguous line segments that closely approximate a line segment
-*	into a single line segment
+*	into a single line segment, using the given Simplifier algorithm
 *
 */
-void Polygon::smooth() {
+void Polygon::smooth(int algorithm) {
 	
-	for (int i = 0; i < (int) vertices.size() - 1; i++) {
-		int j = i + 2;
-		while (can_compress(i,j)) j++;
-		for (int k = i + 1; k < j - 1; k++) delete vertices[k];
-		vertices.erase(vertices.begin() + i + 1, vertices.begin() + j - 1);
-	}
+	Simplifier simplifier(algorithm, MAX_SMOOTH_DIST);
+	simplifier.simplify(&vertices);
 	update_bounds();
+	bvh.clear();
 	
 }
 
-bool Polygon::can_compress(int i, int j) {
-	
-	if (j >= (int) vertices.size()) return false;
-	double dist_ij = get_dist(vertices[i], vertices[j]);
-	double line[2] = { (double) (vertices[j]->x - vertices[i]->x), (double) (vertices[j]->y - vertices[i]->y) };
-	line[0] /= dist_ij;
-	line[1] /= dist_ij;
-
-	assert(i+1 < j);
-	for (int k = i + 1; k < j; k++) {
-		double intersect[2] = { (double) (vertices[i]->x - vertices[k]->x), (double) (vertices[i]->y - vertices[k]->y) };
-		double proj_length = line[0] * intersect[0] + line[1] * intersect[1];
-		double proj[2] = { proj_length * line[0], proj_length * line[1] };
-		double perp[2] = { intersect[0] - proj[0], intersect[1] - proj[1] };
-		double dist = sqrt(perp[0] * perp[0] + perp[1] * perp[1]);
-		if (dist > MAX_SMOOTH_DIST) return false;
-	}
-	
-	return true;
-
+void Polygon::reverse_vertices() {
+	reverse(vertices.begin(), vertices.end());
+	bvh.clear();
 }
 
-void Polygon::reverse_vertices() { reverse(vertices.begin(), vertices.end()); }
+/*
+*
+*	Returns the hierarchy over this polygon's segments, building it the first time it's needed
+*	(e.g. by Polypath::get_min_dist) and again after the vertices change
+*
+*/
+SegmentBVH* Polygon::get_bvh() {
+	if (!bvh.is_built()) bvh.build(&vertices, !is_open());
+	return &bvh;
+}
 
 bool Polygon::is_cw() {
 	int sum = 0;
 	for (int i = 0; i < (int) vertices.size() - 1; i++)
-		sum += (vertices[i+1]->x - vertices[i]->x) * (vertices[i+1]->y + vertices[i]->y);
+		sum += (vertices[i+1].x - vertices[i].x) * (vertices[i+1].y + vertices[i].y);
 	return sum > 0;
 };
 
@@ -100,10 +102,10 @@ void Polygon::update_bounds() {
 
 	int num_vertices = this->get_size();
 	for (int i = 0; i < num_vertices; i++) {
-		if (vertices[i]->x < poly_bounds.x[0]) poly_bounds.x[0] = vertices[i]->x;
-		if (vertices[i]->x > poly_bounds.x[1]) poly_bounds.x[1] = vertices[i]->x;
-		if (vertices[i]->y < poly_bounds.y[0]) poly_bounds.y[0] = vertices[i]->y;
-		if (vertices[i]->y > poly_bounds.y[1]) poly_bounds.y[1] = vertices[i]->y;
+		if (vertices[i].x < poly_bounds.x[0]) poly_bounds.x[0] = vertices[i].x;
+		if (vertices[i].x > poly_bounds.x[1]) poly_bounds.x[1] = vertices[i].x;
+		if (vertices[i].y < poly_bounds.y[0]) poly_bounds.y[0] = vertices[i].y;
+		if (vertices[i].y > poly_bounds.y[1]) poly_bounds.y[1] = vertices[i].y;
 	}
 
 	bounding_rect[0].x = bounding_rect[1].x = poly_bounds.x[0];
@@ -112,9 +114,3 @@ void Polygon::update_bounds() {
 	bounding_rect[2].y = bounding_rect[1].y = poly_bounds.y[1];
 
 }
-
-Polygon::~Polygon() {
-	for (int i = 0; i < (int) vertices.size(); i++) {
-		delete vertices[i];
-	}
-}
\ No newline at end of file
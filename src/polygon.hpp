@@ -5,25 +5,27 @@
 #include <opencv2/opencv.hpp>
 #include "vertex.hpp"
 #include "bounds.hpp"
+#include "segbvh.hpp"
 
 class Polygon {	
 	public:
 		Polygon(std::vector<cv::Point> *contour);
-		void smooth();
+		Polygon(const vertex<int> *_vertices, int n, int _start_index, int _end_index);
+		void smooth(int algorithm);
 		void reverse_vertices();
 		bool is_open();
 		int get_size();
-		static double get_dist(vertex<int> *a, vertex<int> *b);
-		~Polygon();
-		std::vector<vertex<int>*> vertices;
+		static double get_dist(const vertex<int> *a, const vertex<int> *b);
+		SegmentBVH* get_bvh();
+		std::vector<vertex<int> > vertices;
 		bounds<int> poly_bounds;
 		vertex<int> bounding_rect[4];
 		int start_index;
 		int end_index;
 	private:
 		bool is_cw();
-		bool can_compress(int i, int j);
 		void update_bounds();
+		SegmentBVH bvh;
 };
 
 #endif
\ No newline at end of file
@@ -1,4 +1,6 @@
+#include <math.h>
 #include <limits>
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <assert.h>
@@ -11,9 +13,6 @@
 
 using namespace std;
 
-vertex<int>* Polygons::starting_point = nullptr; 
-// final position of the extruder head in current slice, will be the starting point in the subsequent slice
-
 /*
 *
 *	Creates a Polygons object, which stores a set of Polygon objects
@@ -34,22 +33,41 @@ Polygons::Polygons(vector<vector<cv::Point> > *contours) {
 
 }
 
+/*
+*
+*	Restores a finished slice (e.g. from a SliceCache), taking over polygons that have already
+*	been smoothed and ordered, without planning anything
+*
+*/
+Polygons::Polygons(vector<Polygon*> *_polys, const vector<int> *order, const vertex<int> *entry_point) {
+	polys.swap(*_polys);
+	path = new Polypath();
+	path->set_order(order);
+	test_point = *entry_point;
+	get_bounds();
+}
+
 Polygon* Polygons::get_polygon(int i) {
 	return polys[i];
 }
 
+const vector<Polygon*>* Polygons::get_polygons() { return &polys; }
+
 /*
 *
 *	Erase empty polygons, smooth polygons, and generate a path through the polygons
 *	(treating each polygon as a node in a graph - intra-polygon paths will be handled 
-*	separately)
+*	separately). The path starts near predicted_entry; since the real entry point (where the
+*	previous slice's path ended) usually isn't known yet, set_entry_point re-roots it later.
+*	simplify_algorithm picks how polygons are smoothed (see Simplifier), and budget limits the
+*	optional tour improvement (see Polypath::improve_path). Keeps no shared state, so different
+*	slices can be processed concurrently
 *
 */
 
-void Polygons::process_polygons() {
+void Polygons::process_polygons(const vertex<int> *predicted_entry, int simplify_algorithm, const tour_budget *budget) {
 	
-	test_point.x = Polygons::starting_point->x;
-	test_point.y = Polygons::starting_point->y;
+	test_point = *predicted_entry;
 
 	for (int i = 0; i < this->get_num_polys(); i++) {
 		if (!polys[i]->get_size()) {
@@ -57,23 +75,164 @@ void Polygons::process_polygons() {
 			i--;
 			continue;
 		} else {
-			polys[i]->smooth();
+			polys[i]->smooth(simplify_algorithm);
 		}
 	}
 
 	get_bounds();
-	get_polypath();
+	get_polypath(budget);
 
 
 }
 
 int Polygons::get_num_polys() { return (int) polys.size(); }
 
-void Polygons::get_polypath() {
+void Polygons::get_polypath(const tour_budget *budget) {
 
 	if (this->get_num_polys() > 1) {
-		path->get_path(&polys, Polygons::starting_point);		
+		path->get_path(&polys, &test_point, budget);		
+	}
+}
+
+/*
+*
+*	Re-roots the path at entry_point, the final position of the extruder head in the previous
+*	slice, and the shells' paths after it
+*
+*/
+void Polygons::set_entry_point(const vertex<int> *entry_point) {
+	
+	test_point = *entry_point;
+	if (this->get_num_polys() > 1) path->reroot(&polys, entry_point);
+	if (!shells.empty()) plan_shells();
+
+}
+
+/*
+*
+*	Final position of the extruder head in this slice, which will be the starting point in the
+*	subsequent slice: the end of the last hatch line if there's infill, or where the last ring
+*	of the shells was entered, or the end of the path through the polygons. Returns false
+*	(leaving exit_point alone) for slices with none of these
+*
+*/
+bool Polygons::get_exit_point(vertex<int> *exit_point) {
+	
+	if (!infill.empty()) {
+		exit_point->x = (int) lroundf(infill.back().end.x);
+		exit_point->y = (int) lroundf(infill.back().end.y);
+		return true;
+	}
+
+	for (int k = (int) shell_orders.size() - 1; k >= 0; k--) {
+		if (shell_orders[k].empty()) continue;
+		Polygon *ring = shells[k][shell_orders[k].back()];
+		if (!ring->get_size()) continue;
+		*exit_point = ring->vertices[ring->start_index];
+		return true;
+	}
+
+	if (this->get_num_polys() < 2) return false;
+	path->get_exit_point(&polys, exit_point);
+	return true;
+
+}
+
+/*
+*
+*	Orders the rings of each shell (see Slices::shell_layer), outermost first. Each shell starts
+*	where the one outside it ends, the first at get_shell_entry. A closed ring is printed right
+*	round, so it's left where it was entered: the next ring is always the one with the vertex
+*	nearest to where the last one was entered, and it's entered at that vertex. shell_orders[k]
+*	holds the order of shells[k]
+*
+*/
+void Polygons::plan_shells() {
+
+	vertex<int> entry;
+	get_shell_entry(&entry);
+	shell_orders.assign(shells.size(), vector<int>());
+
+	for (int k = 0; k < (int) shells.size(); k++) {
+
+		vector<Polygon*> *level = &shells[k];
+		int num_rings = (int) level->size();
+		vector<bool> done(num_rings, false);
+
+		for (int r = 0; r < num_rings; r++) {
+			int next = -1;
+			int next_vert = 0;
+			int64_t next_dist = numeric_limits<int64_t>::max();
+			for (int j = 0; j < num_rings; j++) {
+				// No vertex of a ring is nearer than its bounds
+				if (done[j] || get_bounds_dist(&(*level)[j]->poly_bounds, &entry) >= next_dist) continue;
+				int64_t dist;
+				int vert = get_nearest_vertex((*level)[j], &entry, &dist);
+				if (dist < next_dist) {
+					next = j;
+					next_vert = vert;
+					next_dist = dist;
+				}
+			}
+			done[next] = true;
+			shell_orders[k].push_back(next);
+			Polygon *ring = (*level)[next];
+			ring->start_index = ring->end_index = next_vert;
+			if (ring->get_size()) entry = ring->vertices[next_vert];
+		}
+
 	}
+
+}
+
+/*
+*
+*	Where the head is when the shells are started: where the last of the polygons printed before
+*	them (the open ones, see GcodeWriter::write_layer) ends, or the entry point if there are none
+*
+*/
+void Polygons::get_shell_entry(vertex<int> *entry_point) {
+	*entry_point = test_point;
+	int num_polys = this->get_num_polys();
+	for (int j = 0; j < num_polys; j++) {
+		Polygon *p = polys[num_polys > 1 ? path->order[j] : 0];
+		int n = p->get_size();
+		if (!n || !p->is_open()) continue;
+		// An open polygon is printed from its nearer end to its farther one
+		int start = p->start_index >= 0 ? p->start_index : 0;
+		*entry_point = p->vertices[start <= n / 2 ? n - 1 : 0];
+	}
+}
+
+/*
+*
+*	The vertex of p nearest to point, and its squared distance (0 for a polygon with no
+*	vertices)
+*
+*/
+int Polygons::get_nearest_vertex(Polygon *p, const vertex<int> *point, int64_t *dist) {
+	int nearest = 0;
+	*dist = p->get_size() ? numeric_limits<int64_t>::max() : 0;
+	for (int k = 0; k < p->get_size(); k++) {
+		int64_t dx = (int64_t) p->vertices[k].x - point->x;
+		int64_t dy = (int64_t) p->vertices[k].y - point->y;
+		if (dx * dx + dy * dy < *dist) {
+			nearest = k;
+			*dist = dx * dx + dy * dy;
+		}
+	}
+	return nearest;
+}
+
+/*
+*
+*	Squared distance from point to the nearest point of b (0 inside it)
+*
+*/
+int64_t Polygons::get_bounds_dist(const bounds<int> *b, const vertex<int> *point) {
+	int64_t dx = max(max((int64_t) b->x[0] - point->x, (int64_t) point->x - b->x[1]), (int64_t) 0);
+	int64_t dy = max(max((int64_t) b->y[0] - point->y, (int64_t) point->y - b->y[1]), (int64_t) 0);
+	return dx * dx + dy * dy;
 }
 
 void Polygons::get_bounds() {
@@ -100,6 +259,11 @@ Polygons::~Polygons() {
 	int num_polys = this->get_num_polys();
 	for (int i = 0; i < num_polys; i++)
 		delete polys[i];
+	for (int i = 0; i < (int) shells.size(); i++)
+		for (int j = 0; j < (int) shells[i].size(); j++)
+			delete shells[i][j];
+	for (int i = 0; i < (int) infill_bounds.size(); i++)
+		delete infill_bounds[i];
 	delete path;
 }
 
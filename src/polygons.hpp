@@ -2,26 +2,39 @@
 #define POLYGONS_H
 
 #include <vector>
+#include <stdint.h>
 #include <opencv2/opencv.hpp>
 #include "vertex.hpp"
 #include "bounds.hpp"
 #include "polygon.hpp"
 #include "polypath.hpp"
+#include "infill.hpp"
 
 class Polygons {	
 	public:
 		Polygons(std::vector<std::vector<cv::Point> > *contours);
-		void process_polygons();
+		Polygons(std::vector<Polygon*> *_polys, const std::vector<int> *order, const vertex<int> *entry_point);
+		void process_polygons(const vertex<int> *predicted_entry, int simplify_algorithm, const tour_budget *budget);
+		void set_entry_point(const vertex<int> *entry_point);
+		bool get_exit_point(vertex<int> *exit_point);
+		void plan_shells();
+		void get_shell_entry(vertex<int> *entry_point);
 		int get_num_polys();
 		Polygon* get_polygon(int i);
+		const std::vector<Polygon*>* get_polygons();
 		~Polygons();
 		Polypath *path;
-		static vertex<int> *starting_point;
 		vertex<int> test_point;
+		std::vector<hatch_line> infill;
+		std::vector<std::vector<Polygon*> > shells;
+		std::vector<Polygon*> infill_bounds;
+		std::vector<std::vector<int> > shell_orders;
 	private:
 		void smooth_polygons();
 		void get_bounds();
-		void get_polypath();
+		void get_polypath(const tour_budget *budget);
+		int get_nearest_vertex(Polygon *p, const vertex<int> *point, int64_t *dist);
+		int64_t get_bounds_dist(const bounds<int> *b, const vertex<int> *point);
 		std::vector<Polygon*> polys;
 		bounds<int> slice_bounds;
 };
@@ -0,0 +1,249 @@
+#include <math.h>
+#include <assert.h>
+#include <limits>
+#include <algorithm>
+#include "polygrid.hpp"
+
+#define GRID_POINTS_PER_CELL 2
+#define GRID_REBUILD_FRAC 4
+
+using namespace std;
+
+/*
+*
+*	A Polygrid buckets the bounding rectangle corners of a set of polygons into a uniform grid,
+*	so that the polygon nearest to another one (by the same corner-to-corner measure as
+*	Polypath::get_min_dist) can be found by searching outwards from a few cells instead of
+*	checking every polygon. Polygons can be removed as a tour visits them; once most of them are
+*	gone the grid is rebuilt more coarsely, so searches stay local until the end
+*
+*/
+Polygrid::Polygrid(vector<Polygon*> *_polys) {
+	polys = _polys;
+	int num_polys = (int) polys->size();
+	removed.assign(num_polys, false);
+	point_pos.assign(4 * num_polys, -1);
+	num_live = num_polys;
+	build();
+}
+
+int Polygrid::get_num_polys() { return num_live; }
+
+/*
+*
+*	(Re)buckets the corners of every polygon that hasn't been removed, picking the cell size so
+*	that cells hold about GRID_POINTS_PER_CELL corners each
+*
+*/
+void Polygrid::build() {
+
+	int num_polys = (int) polys->size();
+	int lo[2] = { numeric_limits<int>::max(), numeric_limits<int>::max() };
+	int hi[2] = { numeric_limits<int>::lowest(), numeric_limits<int>::lowest() };
+	for (int i = 0; i < num_polys; i++) {
+		if (removed[i]) continue;
+		bounds<int> *b = &(*polys)[i]->poly_bounds;
+		if (b->x[0] < lo[0]) lo[0] = b->x[0];
+		if (b->x[1] > hi[0]) hi[0] = b->x[1];
+		if (b->y[0] < lo[1]) lo[1] = b->y[0];
+		if (b->y[1] > hi[1]) hi[1] = b->y[1];
+	}
+
+	num_built = num_live;
+	if (!num_live) return;
+
+	double width = (double) hi[0] - lo[0] + 1;
+	double height = (double) hi[1] - lo[1] + 1;
+	double num_cells = (double) (4 * num_live) / GRID_POINTS_PER_CELL;
+	cell_size = (int) ceil(sqrt(width * height / num_cells));
+	if (cell_size < 1) cell_size = 1;
+
+	origin[0] = lo[0];
+	origin[1] = lo[1];
+	dim[0] = (int) (width / cell_size) + 1;
+	dim[1] = (int) (height / cell_size) + 1;
+
+	// Counting sort of the corners by cell
+	cell_start.assign(dim[0] * dim[1] + 1, 0);
+	for (int i = 0; i < num_polys; i++) {
+		if (removed[i]) continue;
+		for (int j = 0; j < 4; j++) {
+			vertex<int> *v = &(*polys)[i]->bounding_rect[j];
+			cell_start[((v->y - origin[1]) / cell_size) * dim[0] + (v->x - origin[0]) / cell_size + 1]++;
+		}
+	}
+	for (int c = 0; c < dim[0] * dim[1]; c++)
+		cell_start[c + 1] += cell_start[c];
+
+	cell_count.assign(dim[0] * dim[1], 0);
+	cell_points.resize(4 * num_live);
+	for (int i = 0; i < num_polys; i++) {
+		if (removed[i]) continue;
+		for (int j = 0; j < 4; j++) {
+			vertex<int> *v = &(*polys)[i]->bounding_rect[j];
+			int c = ((v->y - origin[1]) / cell_size) * dim[0] + (v->x - origin[0]) / cell_size;
+			int pos = cell_start[c] + cell_count[c]++;
+			cell_points[pos] = 4 * i + j;
+			point_pos[4 * i + j] = pos;
+		}
+	}
+
+}
+
+/*
+*
+*	Takes a polygon out of the grid, e.g. once a tour has visited it
+*
+*/
+void Polygrid::remove(int poly_index) {
+
+	assert(!removed[poly_index]);
+	removed[poly_index] = true;
+	num_live--;
+
+	for (int j = 0; j < 4; j++) {
+		vertex<int> *v = &(*polys)[poly_index]->bounding_rect[j];
+		int c = ((v->y - origin[1]) / cell_size) * dim[0] + (v->x - origin[0]) / cell_size;
+		int pos = point_pos[4 * poly_index + j];
+		int last = cell_start[c] + --cell_count[c];
+		cell_points[pos] = cell_points[last];
+		point_pos[cell_points[pos]] = pos;
+		point_pos[4 * poly_index + j] = -1;
+	}
+
+	if (num_live && num_live * GRID_REBUILD_FRAC < num_built) build();
+
+}
+
+/*
+*
+*	Returns the index of the polygon still in the grid that is nearest to from, measured between
+*	the corners of their bounding rectangles, or -1 if the grid is empty. Ties go to the lower
+*	index, so the answer doesn't depend on the layout of the grid. from itself should already
+*	have been removed
+*
+*/
+int Polygrid::get_nearest(Polygon *from) {
+
+	best.clear();
+	max_best = 1;
+	exclude = -1;
+	if (!num_live) return -1;
+
+	for (int j = 0; j < 4; j++)
+		search(&from->bounding_rect[j]);
+
+	return best.empty() ? -1 : best[0].second;
+
+}
+
+/*
+*
+*	Stores the indices of the (up to) k polygons still in the grid nearest to polygon from_index,
+*	nearest first, in out. from_index itself is skipped whether or not it has been removed
+*
+*/
+void Polygrid::get_nearest(int from_index, int k, vector<int> *out) {
+
+	best.clear();
+	max_best = k;
+	exclude = from_index;
+	out->clear();
+	if (!num_live || k <= 0) return;
+
+	Polygon *from = (*polys)[from_index];
+	for (int j = 0; j < 4; j++)
+		search(&from->bounding_rect[j]);
+
+	for (int i = 0; i < (int) best.size(); i++)
+		out->push_back(best[i].second);
+
+}
+
+/*
+*
+*	Scans rings of cells of increasing radius around q, stopping once the next ring can't
+*	hold anything closer than the candidates found so far
+*
+*/
+void Polygrid::search(const vertex<int> *q) {
+
+	int cx = (q->x - origin[0]) / cell_size;
+	int cy = (q->y - origin[1]) / cell_size;
+	if (q->x < origin[0]) cx = 0;
+	if (q->y < origin[1]) cy = 0;
+	if (cx >= dim[0]) cx = dim[0] - 1;
+	if (cy >= dim[1]) cy = dim[1] - 1;
+
+	int max_r = max(max(cx, dim[0] - 1 - cx), max(cy, dim[1] - 1 - cy));
+
+	for (int r = 0; r <= max_r; r++) {
+
+		if (r > 0 && (int) best.size() == max_best) {
+			// Anything in ring r lies outside the block of cells within r - 1 of (cx, cy)
+			int64_t left = q->x - (origin[0] + (int64_t) (cx - r + 1) * cell_size);
+			int64_t right = origin[0] + (int64_t) (cx + r) * cell_size - q->x;
+			int64_t bottom = q->y - (origin[1] + (int64_t) (cy - r + 1) * cell_size);
+			int64_t top = origin[1] + (int64_t) (cy + r) * cell_size - q->y;
+			int64_t gap = min(min(left, right), min(bottom, top));
+			if (gap > 0 && gap * gap > best.back().first) return;
+		}
+
+		if (r == 0) {
+			scan_cell(cx, cy, q);
+			continue;
+		}
+
+		for (int x = cx - r; x <= cx + r; x++) {
+			scan_cell(x, cy - r, q);
+			scan_cell(x, cy + r, q);
+		}
+		for (int y = cy - r + 1; y <= cy + r - 1; y++) {
+			scan_cell(cx - r, y, q);
+			scan_cell(cx + r, y, q);
+		}
+
+	}
+
+}
+
+void Polygrid::scan_cell(int cx, int cy, const vertex<int> *q) {
+
+	if (cx < 0 || cy < 0 || cx >= dim[0] || cy >= dim[1]) return;
+
+	int c = cy * dim[0] + cx;
+	for (int k = cell_start[c]; k < cell_start[c] + cell_count[c]; k++) {
+		int id = cell_points[k];
+		if (id / 4 == exclude) continue;
+		vertex<int> *v = &(*polys)[id / 4]->bounding_rect[id % 4];
+		int64_t dx = (int64_t) v->x - q->x;
+		int64_t dy = (int64_t) v->y - q->y;
+		add_candidate(dx * dx + dy * dy, id / 4);
+	}
+
+}
+
+/*
+*
+*	Keeps best sorted by (distance, index) and holding at most max_best distinct polygons, each
+*	at the distance of its nearest corner
+*
+*/
+void Polygrid::add_candidate(int64_t dist, int poly_index) {
+
+	pair<int64_t, int> cand(dist, poly_index);
+	int n = (int) best.size();
+
+	int k = 0;
+	while (k < n && best[k].second != poly_index) k++;
+	if (k < n) {
+		if (cand >= best[k]) return;
+		best.erase(best.begin() + k);
+	} else if (n == max_best) {
+		if (cand >= best.back()) return;
+		best.pop_back();
+	}
+
+	best.insert(upper_bound(best.begin(), best.end(), cand), cand);
+
+}
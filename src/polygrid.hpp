@@ -0,0 +1,38 @@
+#ifndef POLYGRID_H
+#define POLYGRID_H
+
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include "vertex.hpp"
+#include "polygon.hpp"
+
+class Polygrid {
+	public:
+		Polygrid(std::vector<Polygon*> *_polys);
+		int get_nearest(Polygon *from);
+		void get_nearest(int from_index, int k, std::vector<int> *out);
+		void remove(int poly_index);
+		int get_num_polys();
+	private:
+		void build();
+		void search(const vertex<int> *q);
+		void scan_cell(int cx, int cy, const vertex<int> *q);
+		void add_candidate(int64_t dist, int poly_index);
+		std::vector<Polygon*> *polys;
+		std::vector<int> cell_start;
+		std::vector<int> cell_count;
+		std::vector<int> cell_points;
+		std::vector<int> point_pos;
+		std::vector<bool> removed;
+		int num_live;
+		int num_built;
+		int origin[2];
+		int cell_size;
+		int dim[2];
+		std::vector<std::pair<int64_t, int> > best;
+		int max_best;
+		int exclude;
+};
+
+#endif
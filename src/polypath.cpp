@@ -1,133 +1,450 @@
 #include <limits>
+#include <algorithm>
+#include <chrono>
 #include "polypath.hpp"
+#include "polygrid.hpp"
 #include "bounds.hpp"
 
+#define TOUR_NEIGHBOURS 8
+#define MAX_OR_OPT_LEN 3
+#define MIN_GAIN 1e-7
+
 using namespace std;
 
-Polypath::Polypath() { num_nodes = -1; }
+Polypath::Polypath() {
+	num_nodes = -1;
+	travel_before = travel_after = 0;
+}
 
 /*
 *
 *	A polypath object generates a path through the polygons in a given slice.
-*	Treats each polygon as a node in a graph, uses a heuristic to gauge pairwise
-*	distances between each polygon and to generate a complete graph representing
-*	the slice. Polypath implements the nearest neighbor algorithm to quickly find a (not necessarily
-*	optimal) tour.
+*	Treats each polygon as a node in a graph, and uses a heuristic to gauge the distance
+*	between polygons. Polypath implements the nearest neighbor algorithm to quickly find a (not
+*	necessarily optimal) tour, looking neighbors up in a Polygrid rather than building the
+*	complete graph, so time and memory stay close to linear in the number of polygons.
+*	If the budget allows any passes, the tour is then shortened by local search (see
+*	improve_path), and the unimproved tour is kept so that reroot can compare the two
 *
 */
-void Polypath::get_path(vector<Polygon*> *polys, vertex<int> *starting_point) {
+void Polypath::get_path(vector<Polygon*> *polys, const vertex<int> *starting_point, const tour_budget *budget) {
 
 	num_nodes = polys->size();
+	unimproved.clear();
+	legs.clear();
 
-	adj_mat = new int*[num_nodes];
-	vertex_index_mat = new int*[num_nodes];
-	for (int i = 0; i < num_nodes; i++) {
-		adj_mat[i] = new int[num_nodes];
-		vertex_index_mat[i] = new int[num_nodes];
+	int first_vertex_index;
+	int first_poly_index = get_starting_poly(polys, starting_point, &first_vertex_index);
+
+	calculate_path(polys, first_poly_index);
+
+	if (budget && budget->max_passes > 0 && num_nodes > 3) {
+		vector<int> nearest_neighbour = order;
+		improve_path(polys, budget);
+		cut_cycle(polys, starting_point);
+		unimproved.swap(nearest_neighbour);
+	} else {
+		get_vertex_ids(polys, first_vertex_index);
 	}
 
+}
+
+/*
+*
+*	Improves the tour, treated as a cycle, with 2-opt and Or-opt moves. Each polygon only
+*	considers moves that link it to one of its TOUR_NEIGHBOURS nearest polygons, and passes over
+*	all polygons repeat until none of them finds an improving move, budget->max_passes passes have
+*	run, or (if budget->max_ms > 0) the time is up. The caller cuts the cycle open again
+*
+*/
+void Polypath::improve_path(vector<Polygon*> *polys, const tour_budget *budget) {
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	// The grid finds candidates by their bounding rects; they're then ranked by the real leg
+	Polygrid grid(polys);
+	vector<vector<int> > neighbours(num_nodes);
 	for (int i = 0; i < num_nodes; i++) {
-		for (int j = 0; j < num_nodes; j++) {
-			adj_mat[i][j] = -1;
-			vertex_index_mat[i][j] = -1;
-		}
+		grid.get_nearest(i, TOUR_NEIGHBOURS, &neighbours[i]);
+		sort(neighbours[i].begin(), neighbours[i].end(), [this, polys, i](int b, int c) {
+			return get_leg(polys, i, b) < get_leg(polys, i, c);
+		});
 	}
 
-	visited = new bool[num_nodes];
-	for (int i = 0; i < num_nodes; i++)
-		visited[i] = false;
+	pos.resize(num_nodes);
+	for (int k = 0; k < num_nodes; k++)
+		pos[order[k]] = k;
 
-	generate_graph(polys);
+	for (int pass = 0; pass < budget->max_passes; pass++) {
 
-	int first_vertex_index;
-	int first_poly_index = get_starting_poly(polys, starting_point, &first_vertex_index);
+		bool improved = false;
+		for (int a = 0; a < num_nodes; a++) {
+			if (budget->max_ms > 0 && chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() > budget->max_ms)
+				return;
+			if (two_opt(polys, a, &neighbours[a])) improved = true;
+			if (or_opt(polys, a, &neighbours)) improved = true;
+		}
+		if (!improved) break;
 
-	assert(calculate_path(first_poly_index));
-	get_vertex_ids(polys, first_vertex_index);
-	update_starting_point(polys, starting_point);
+	}
 
 }
 
 /*
 *
-*	Store a pointer to the ending point of the final polygon's intra-polygon path, as this
-*	will be the starting point of the subsequent slice
+*	Tries to replace two legs of the cycle, one of them touching polygon a, with a leg from a to
+*	one of its neighbours plus the leg joining the two polygons left dangling, reversing the
+*	stretch of the tour in between. Applies the first move that shortens the tour
 *
 */
-void Polypath::update_starting_point(vector<Polygon*> *polys, vertex<int> *starting_point) {
-	Polygon *last_poly = (*polys)[order[num_nodes - 1]];
-	vertex<int> *last_vertex = last_poly->vertices[last_poly->get_size() - 1];
-	starting_point->x = last_vertex->x;
-	starting_point->y = last_vertex->y;
+bool Polypath::two_opt(vector<Polygon*> *polys, int a, vector<int> *neighbours) {
+
+	int p = pos[a];
+	double succ_leg = get_leg(polys, a, order[(p + 1) % num_nodes]);
+	double pred_leg = get_leg(polys, a, order[(p + num_nodes - 1) % num_nodes]);
+
+	for (int n = 0; n < (int) neighbours->size(); n++) {
+
+		int c = (*neighbours)[n];
+		double new_leg = get_leg(polys, a, c);
+		if (new_leg >= succ_leg && new_leg >= pred_leg) break;
+
+		int q = pos[c];
+		int lo = min(p, q), hi = max(p, q);
+
+		// Legs (i, i+1) and (j, j+1) become (i, j) and (i+1, j+1); a's successor leg is replaced
+		// when a and c are i and j, and its predecessor leg when they are i+1 and j+1
+		for (int variant = 0; variant < 2; variant++) {
+
+			int i = variant ? lo - 1 : lo;
+			int j = variant ? hi - 1 : hi;
+			if (i < 0 || j - i < 2 || (i == 0 && j == num_nodes - 1)) continue;
+			if (new_leg >= (variant ? pred_leg : succ_leg)) continue;
+
+			int u = order[i], u_next = order[i + 1];
+			int v = order[j], v_next = order[(j + 1) % num_nodes];
+			double gain = get_leg(polys, u, u_next) + get_leg(polys, v, v_next) - get_leg(polys, u, v) - get_leg(polys, u_next, v_next);
+			if (gain <= MIN_GAIN) continue;
+
+			// Reversing the stretch outside (i, j] gives the same cycle, so reverse the shorter one
+			if (j - i <= num_nodes - (j - i)) reverse_span(i + 1, j);
+			else reverse_span((j + 1) % num_nodes, i);
+			return true;
+
+		}
+
+	}
+
+	return false;
+
 }
 
 /*
 *
-*	Recursive implementation of the nearest-neighbor algorithm to produce a solution to
-*	the traveling salesman problem.
+*	Tries to move a short run of the tour starting at polygon a (up to MAX_OR_OPT_LEN polygons,
+*	in either orientation) to a leg next to one of the neighbours of its first or last polygon.
+*	Applies the first move that shortens the tour
 *
 */
-int Polypath::calculate_path(int curr_index) {
-	
-	assert(curr_index < num_nodes);
-	visited[curr_index] = true;
-	order.push_back(curr_index);
-	
-	int min_dist = numeric_limits<int>::max();
-	int min_index = -1;
+bool Polypath::or_opt(vector<Polygon*> *polys, int a, vector<vector<int> > *neighbours) {
+
+	int s = pos[a];
+
+	for (int len = 1; len <= MAX_OR_OPT_LEN && len + 3 <= num_nodes; len++) {
+
+		int first = a;
+		int last = order[(s + len - 1) % num_nodes];
+		int prev = order[(s + num_nodes - 1) % num_nodes];
+		int next = order[(s + len) % num_nodes];
+		double removal_gain = get_leg(polys, prev, first) + get_leg(polys, last, next) - get_leg(polys, prev, next);
+		if (removal_gain <= MIN_GAIN) continue;
+
+		for (int e = 0; e < 2; e++) {
+
+			vector<int> *near = &(*neighbours)[e ? last : first];
+			for (int n = 0; n < (int) near->size(); n++) {
+
+				int c = (*near)[n];
+				if ((pos[c] - s + num_nodes) % num_nodes < len) continue;
+
+				// Insert between c and its successor, or between its predecessor and c
+				for (int side = 0; side < 2; side++) {
+
+					int u = side ? order[(pos[c] + num_nodes - 1) % num_nodes] : c;
+					int v = side ? c : order[(pos[c] + 1) % num_nodes];
+					if ((pos[u] - s + num_nodes) % num_nodes < len) continue;
+					if ((pos[v] - s + num_nodes) % num_nodes < len) continue;
+
+					double forward = get_leg(polys, u, first) + get_leg(polys, last, v);
+					double backward = get_leg(polys, u, last) + get_leg(polys, first, v);
+					double cost = min(forward, backward) - get_leg(polys, u, v);
+					if (removal_gain - cost <= MIN_GAIN) continue;
+
+					move_run(s, len, u, backward < forward);
+					return true;
+
+				}
 
-	bool finished = true;
-	for (int i = 0; i < num_nodes; i++) {
-		if (!visited[i]) {
-			finished = false;
-			if (adj_mat[curr_index][i] < min_dist) {
-				min_dist = adj_mat[curr_index][i];
-				min_index = i;
 			}
+
 		}
+
 	}
 
-	if (finished) return 1;
-	else {
-		if (min_index < 0) return 0;
-		else return calculate_path(min_index);
+	return false;
+
+}
+
+/*
+*
+*	Reverses the stretch of the cycle from position from_pos to to_pos (inclusive, wrapping
+*	around the end of order if needed)
+*
+*/
+void Polypath::reverse_span(int from_pos, int to_pos) {
+	int len = (to_pos - from_pos + num_nodes) % num_nodes + 1;
+	for (int k = 0; k < len / 2; k++) {
+		int x = (from_pos + k) % num_nodes;
+		int y = (to_pos - k + num_nodes) % num_nodes;
+		swap(order[x], order[y]);
+		pos[order[x]] = x;
+		pos[order[y]] = y;
 	}
+}
+
+/*
+*
+*	Moves the run of len polygons at positions s, s + 1, ... (wrapping around) to just after
+*	polygon u, reversing it if reversed. Only the polygons between the run and u, on whichever
+*	side of the cycle holds fewer of them, are shifted along to make room
+*
+*/
+void Polypath::move_run(int s, int len, int u, bool reversed) {
+
+	int run[MAX_OR_OPT_LEN];
+	for (int k = 0; k < len; k++)
+		run[k] = order[(s + (reversed ? len - 1 - k : k)) % num_nodes];
+
+	// after: the polygons from the end of the run up to u; before: from u's successor up to
+	// the start of the run
+	int after = (pos[u] - (s + len - 1) + 2 * num_nodes) % num_nodes;
+	int before = num_nodes - len - after;
+
+	if (after <= before) {
+		for (int k = 0; k < after; k++) {
+			int x = (s + k) % num_nodes;
+			order[x] = order[(s + len + k) % num_nodes];
+			pos[order[x]] = x;
+		}
+		for (int k = 0; k < len; k++) {
+			int x = (s + after + k) % num_nodes;
+			order[x] = run[k];
+			pos[run[k]] = x;
+		}
+	} else {
+		int first = (s - before + num_nodes) % num_nodes;
+		for (int k = before - 1; k >= 0; k--) {
+			int x = (first + k + len) % num_nodes;
+			order[x] = order[(first + k) % num_nodes];
+			pos[order[x]] = x;
+		}
+		for (int k = 0; k < len; k++) {
+			int x = (first + k) % num_nodes;
+			order[x] = run[k];
+			pos[run[k]] = x;
+		}
+	}
+
+}
+
+/*
+*
+*	Length of the travel move between polygons a and b: the distance between their closest
+*	vertices, which is the leg get_vertex_ids prints, so moves are scored by the travel they
+*	actually save
+*
+*/
+double Polypath::get_leg(vector<Polygon*> *polys, int a, int b) {
+	return find_leg(polys, a, b)->dist;
+}
+
+/*
+*
+*	The leg between polygons a and b, looked up once (see get_min_dist) and then kept for the
+*	rest of the planning and for every re-rooting of the tour. low_vert is the vertex on the
+*	lower-numbered polygon of the two
+*
+*/
+const tour_leg* Polypath::find_leg(vector<Polygon*> *polys, int a, int b) {
+
+	int lo = min(a, b), hi = max(a, b);
+	uint64_t key = ((uint64_t) (uint32_t) lo << 32) | (uint32_t) hi;
+	unordered_map<uint64_t, tour_leg>::iterator it = legs.find(key);
+	if (it != legs.end()) return &it->second;
+
+	tour_leg leg;
+	leg.dist = get_min_dist((*polys)[lo], (*polys)[hi], &leg.low_vert, &leg.high_vert);
+	return &legs.insert(make_pair(key, leg)).first->second;
+
+}
+
+/*
+*
+*	Length of the travel moves between the tour's polygons, as they'll be printed: the hop
+*	from entry_point to the first polygon's start vertex, then from each polygon's end vertex
+*	to the next one's start vertex (see get_vertex_ids)
+*
+*/
+double Polypath::get_travel(vector<Polygon*> *polys, const vertex<int> *entry_point) {
+	Polygon *first = (*polys)[order[0]];
+	double length = Polygon::get_dist(entry_point, &first->vertices[first->start_index]);
+	for (int k = 0; k + 1 < num_nodes; k++) {
+		Polygon *curr = (*polys)[order[k]];
+		Polygon *next = (*polys)[order[k + 1]];
+		length += Polygon::get_dist(&curr->vertices[curr->end_index], &next->vertices[next->start_index]);
+	}
+	return length;
+}
+
+/*
+*
+*	Re-roots a tour that was planned from a guessed starting point at the real one. The tour is
+*	treated as a cycle (closing it from the last polygon back to the first) and cut open again
+*	at the leg whose removal, plus the hop from entry_point to the polygon after it, costs the
+*	least. The legs were all measured while planning (see find_leg), so this only needs a
+*	constant amount of work per polygon, and is cheap enough to run sequentially over every
+*	layer once all tours have been planned in parallel. travel_before and travel_after record
+*	the travel (see get_travel) of the unimproved and the final tour, each re-rooted at
+*	entry_point. If the improved tour comes out longer, the unimproved one is kept
+*
+*/
+void Polypath::reroot(vector<Polygon*> *polys, const vertex<int> *entry_point) {
+
+	if (!unimproved.empty()) {
+		order.swap(unimproved);
+		cut_cycle(polys, entry_point);
+		travel_before = get_travel(polys, entry_point);
+		order.swap(unimproved);
+	}
+
+	cut_cycle(polys, entry_point);
+	travel_after = get_travel(polys, entry_point);
+	if (unimproved.empty()) travel_before = travel_after;
+
+	// Improving the cycle can still lose out once it's cut open at the entry point
+	if (travel_after > travel_before) {
+		order = unimproved;
+		cut_cycle(polys, entry_point);
+		travel_after = travel_before;
+	}
+
+}
+
+/*
+*
+*	Cuts the cycle open at the leg that best suits entry_point (see reroot) and reassigns the
+*	polygons' start and end vertices
+*
+*/
+void Polypath::cut_cycle(vector<Polygon*> *polys, const vertex<int> *entry_point) {
+
+	assert(num_nodes > 1 && (int) order.size() == num_nodes);
+
+	// leg_dist[k] is the length of the leg from order[k] to the polygon after it on the cycle
+	vector<double> leg_dist(num_nodes);
+	for (int k = 0; k < num_nodes; k++)
+		leg_dist[k] = get_leg(polys, order[k], order[(k + 1) % num_nodes]);
+
+	// The cycle can be cut open and walked in either direction
+	int best_cut = 0;
+	bool best_reversed = false;
+	double best_cost = numeric_limits<double>::max();
+	for (int k = 0; k < num_nodes; k++) {
+		double entry_dist = get_entry_dist(entry_point, (*polys)[order[k]]);
+		double prev_leg = leg_dist[(k + num_nodes - 1) % num_nodes];
+		if (entry_dist - prev_leg < best_cost) {
+			best_cost = entry_dist - prev_leg;
+			best_cut = k;
+			best_reversed = false;
+		}
+		if (entry_dist - leg_dist[k] < best_cost) {
+			best_cost = entry_dist - leg_dist[k];
+			best_cut = k;
+			best_reversed = true;
+		}
+	}
+
+	rotate(order.begin(), order.begin() + best_cut, order.end());
+	if (best_reversed) reverse(order.begin() + 1, order.end());
+	get_vertex_ids(polys, get_closest_vert(entry_point, (*polys)[order[0]]));
+
+}
+
+/*
+*
+*	The ending point of the final polygon's intra-polygon path, which will be the starting
+*	point of the subsequent slice
+*
+*/
+void Polypath::get_exit_point(vector<Polygon*> *polys, vertex<int> *exit_point) {
+	Polygon *last_poly = (*polys)[order[num_nodes - 1]];
+	*exit_point = last_poly->vertices[last_poly->get_size() - 1];
+}
+
+/*
+*
+*	Iterative implementation of the nearest-neighbor algorithm to produce a solution to
+*	the traveling salesman problem. Visited polygons are removed from the grid, so each step
+*	only searches the neighbourhood of the current polygon for the nearest unvisited one.
+*	Should the grid ever come up empty while polygons are left, they're visited in index order
+*	so the tour still covers every polygon
+*
+*/
+void Polypath::calculate_path(vector<Polygon*> *polys, int first_index) {
+	
+	assert(first_index < num_nodes);
+	Polygrid grid(polys);
+	order.clear();
+	vector<bool> visited(num_nodes, false);
+
+	int curr_index = first_index;
+	while (curr_index >= 0) {
+		order.push_back(curr_index);
+		visited[curr_index] = true;
+		grid.remove(curr_index);
+		if (!grid.get_num_polys()) return;
+		curr_index = grid.get_nearest((*polys)[curr_index]);
+	}
+
+	for (int i = 0; i < num_nodes; i++)
+		if (!visited[i]) order.push_back(i);
 	
 }
 
 /*
 *
 *	Store the indices of the starting and ending vertices for each polygon given the 
-*	tour produced by calculate_path
+*	tour produced by calculate_path. Each leg from polygon order[i] to order[i+1] leaves the
+*	former and enters the latter at the vertices get_min_dist picks for the pair
 *
 */
 void Polypath::get_vertex_ids(vector<Polygon*> *polys, int first_vertex_index) {
 	
-	int first_poly = order[0];
-	int second_poly = order[1];
-	
-	(*polys)[first_poly]->start_index = first_vertex_index;
-	(*polys)[first_poly]->end_index = vertex_index_mat[first_poly][second_poly];
-	
-	check_ids((*polys)[first_poly]);
-
-	for (int i = 1; i < num_nodes - 1; i++) {
-		int prev_poly = order[i-1];
-		int curr_poly = order[i];
-		int next_poly = order[i+1];
-		
-		(*polys)[curr_poly]->start_index = vertex_index_mat[curr_poly][prev_poly];
-		(*polys)[curr_poly]->end_index = vertex_index_mat[curr_poly][next_poly];
-		
-		check_ids((*polys)[curr_poly]);
+	(*polys)[order[0]]->start_index = first_vertex_index;
+
+	for (int i = 0; i < num_nodes - 1; i++) {
+		Polygon *curr_poly = (*polys)[order[i]];
+		Polygon *next_poly = (*polys)[order[i+1]];
+		const tour_leg *leg = find_leg(polys, order[i], order[i+1]);
+		bool curr_low = order[i] < order[i+1];
+		curr_poly->end_index = curr_low ? leg->low_vert : leg->high_vert;
+		next_poly->start_index = curr_low ? leg->high_vert : leg->low_vert;
+		check_ids(curr_poly);
 	}
 
-	int penult_poly = order[num_nodes - 2];
-	int final_poly = order[num_nodes - 1];
-	
-	(*polys)[final_poly]->start_index = vertex_index_mat[final_poly][penult_poly];
-	(*polys)[final_poly]->end_index = 0; // temporary -> this will ultimately be determined by the intra-polygon path
-	check_ids((*polys)[final_poly]);
+	Polygon *final_poly = (*polys)[order[num_nodes - 1]];
+	final_poly->end_index = 0; // temporary -> this will ultimately be determined by the intra-polygon path
+	check_ids(final_poly);
 
 }
 
@@ -138,71 +455,23 @@ void Polypath::check_ids(Polygon *p) {
 	assert(p->end_index < p->get_size());
 }
 
-void Polypath::generate_graph(vector<Polygon*> *polys) {
-	
-	for (int i = 0; i < num_nodes; i++) {
-		for (int j = i + 1; j < num_nodes; j++) {
-			
-			int i_vert_ind = -1, j_vert_ind = -1;
-			assert(i < (int)polys->size());
-			assert(j < (int)polys->size());
-			
-			Polygon *a = (*polys)[i];
-			Polygon *b = (*polys)[j];
-		
-			adj_mat[i][j] = get_min_dist(a, b, &i_vert_ind, &j_vert_ind);
-			adj_mat[j][i] = adj_mat[i][j];
-			
-			/*
-			*	Given the edge from node/polygon i to j, vertex_index_mat[i][j] stores the index of the 
-			*	vertex in polygon i associated with the edge, while vertex_index_mat[j][i] stores
-			*	the corresponding vertex index for polygon j
-			*/
-			vertex_index_mat[i][j] = i_vert_ind;
-			vertex_index_mat[j][i] = j_vert_ind;
-		}
-	}
-
-}
-
 /*
 *
-*	Min distance between two polygons is calculated as follows: First, find min distance between
-*	each corner of the bounding rectangles of each polygon. Then, find the closest point in each polygon
-*	to the corner of the bounding rect identified in the previous step. Finally, return the distance
-*	between each point identified in part 2, and store the vertices' indices using the int pointer args
+*	Distance between the closest pair of vertices of two polygons, found by descending the
+*	segment hierarchies of both (see SegmentBVH) rather than comparing every pair of vertices.
+*	Stores the indices of that pair using the int pointer args, which become the travel edge
+*	between the polygons
 *
 */
-int Polypath::get_min_dist(Polygon *a, Polygon *b, int *a_vert_ind, int *b_vert_ind) {
+double Polypath::get_min_dist(Polygon *a, Polygon *b, int *a_vert_ind, int *b_vert_ind) {
 	
 	assert(a != nullptr);
 	assert(b != nullptr);
 
-	double min_dist = numeric_limits<double>::max();
-	int rect_point_a = -1;
-	int rect_point_b = -1;
-
-	for (int i = 0; i < 4; i++) {
-		for (int j = 0; j < 4; j++) {
-			double curr_dist = Polygon::get_dist(&a->bounding_rect[i], &b->bounding_rect[j]); 
-			assert(curr_dist >= 0);
-			if ( curr_dist < min_dist ) {
-				min_dist = curr_dist;
-				rect_point_a = i;
-				rect_point_b = j;
-			}
-		}
-	}
-
-	assert(rect_point_a >= 0);
-	assert(rect_point_b >= 0);
-	assert(min_dist >= 0);	
-
-	*a_vert_ind = get_closest_vert(&a->bounding_rect[rect_point_a], a);
-	*b_vert_ind = get_closest_vert(&b->bounding_rect[rect_point_b], b);
+	double min_dist = SegmentBVH::get_min_dist(a->get_bvh(), b->get_bvh(), a_vert_ind, b_vert_ind);
 
 	assert(min_dist >= 0);
-	return (int) min_dist;
+	return min_dist;
 
 }
 
@@ -211,14 +480,14 @@ int Polypath::get_min_dist(Polygon *a, Polygon *b, int *a_vert_ind, int *b_vert_
 *	Returns the index of the vertex in Polygon p that is closest to the vertex point
 *
 */
-int Polypath::get_closest_vert(vertex<int> *point, Polygon *p) {
+int Polypath::get_closest_vert(const vertex<int> *point, Polygon *p) {
 	
 	int num_vertices = p->get_size();
 	double min_dist = numeric_limits<double>::max();
 	int closest_index = -1;
 
 	for (int i = 0; i < num_vertices; i++) {
-		double curr_dist = Polygon::get_dist(point, p->vertices[i]);
+		double curr_dist = Polygon::get_dist(point, &p->vertices[i]);
 		if (curr_dist < min_dist) {
 			min_dist = curr_dist;
 			closest_index = i; 
@@ -237,11 +506,10 @@ int Polypath::get_closest_vert(vertex<int> *point, Polygon *p) {
 *	Returns the index of the polygon with the lowest heuristic distance from the slice's starting point
 *
 */
-int Polypath::get_starting_poly(vector<Polygon*> *polys, vertex<int> *starting_point, int *starting_vert) {
+int Polypath::get_starting_poly(vector<Polygon*> *polys, const vertex<int> *starting_point, int *starting_vert) {
 	
 	assert(starting_point);
 	int poly_index = -1;
-	int rect_index = -1;
 	double min_dist = numeric_limits<double>::max();
 
 	for (int i = 0; i < num_nodes; i++) {
@@ -250,25 +518,40 @@ int Polypath::get_starting_poly(vector<Polygon*> *polys, vertex<int> *starting_p
 			if (curr_dist < min_dist) {
 				min_dist = curr_dist;
 				poly_index = i;
-				rect_index = j;
 			} 
 		}
 	}
 
 	assert(poly_index >= 0);
-	assert(rect_index >= 0);
 
 	*starting_vert = get_closest_vert(starting_point, (*polys)[poly_index]);
 
 	return poly_index;
 }
 
-Polypath::~Polypath() {
-	for (int i = 0; i < num_nodes; i++) {
-		delete adj_mat[i];
-		delete vertex_index_mat[i];
+/*
+*
+*	Heuristic distance from a point to a polygon, measured to the nearest corner of its
+*	bounding rectangle (the same measure get_starting_poly uses)
+*
+*/
+double Polypath::get_entry_dist(const vertex<int> *point, Polygon *p) {
+	double min_dist = numeric_limits<double>::max();
+	for (int j = 0; j < 4; j++) {
+		double curr_dist = Polygon::get_dist(point, &p->bounding_rect[j]);
+		if (curr_dist < min_dist) min_dist = curr_dist;
 	}
-	delete adj_mat;
-	delete vertex_index_mat;
-	delete visited;
+	return min_dist;
+}
+
+/*
+*
+*	Takes a finished visiting order (e.g. from a SliceCache) instead of planning one
+*
+*/
+void Polypath::set_order(const vector<int> *_order) {
+	order = *_order;
+	num_nodes = (int) order.size();
 }
+
+Polypath::~Polypath() {}
@@ -2,28 +2,54 @@
 #define POLYPATH_H
 
 #include <vector>
+#include <stdint.h>
+#include <unordered_map>
 #include "polygon.hpp"
 
+struct tour_budget {
+	int max_passes;
+	double max_ms;
+};
+
+struct tour_leg {
+	double dist;
+	int low_vert;
+	int high_vert;
+};
+
 class Polypath {	
 	public:
 		Polypath();
-		void get_path(std::vector<Polygon*> *polys, vertex<int> *starting_point);
+		void get_path(std::vector<Polygon*> *polys, const vertex<int> *starting_point, const tour_budget *budget);
+		void reroot(std::vector<Polygon*> *polys, const vertex<int> *entry_point);
+		void get_exit_point(std::vector<Polygon*> *polys, vertex<int> *exit_point);
+		void set_order(const std::vector<int> *_order);
 		bool is_init();
 		~Polypath();
 		std::vector<int> order;
+		double travel_before;
+		double travel_after;
 	private:
-		int calculate_path(int curr_index);
+		void calculate_path(std::vector<Polygon*> *polys, int first_index);
+		void improve_path(std::vector<Polygon*> *polys, const tour_budget *budget);
+		bool two_opt(std::vector<Polygon*> *polys, int a, std::vector<int> *neighbours);
+		bool or_opt(std::vector<Polygon*> *polys, int a, std::vector<std::vector<int> > *neighbours);
+		void reverse_span(int from_pos, int to_pos);
+		void move_run(int s, int len, int u, bool reversed);
+		double get_leg(std::vector<Polygon*> *polys, int a, int b);
+		const tour_leg* find_leg(std::vector<Polygon*> *polys, int a, int b);
+		void cut_cycle(std::vector<Polygon*> *polys, const vertex<int> *entry_point);
+		double get_travel(std::vector<Polygon*> *polys, const vertex<int> *entry_point);
 		void get_vertex_ids(std::vector<Polygon*> *polys, int first_vertex_index);
-		void generate_graph(std::vector<Polygon*> *polys);
-		int get_min_dist(Polygon *a, Polygon *b, int *a_vert_ind, int *b_vert_ind);
-		int get_closest_vert(vertex<int> *rect_vert, Polygon *p);
-		int get_starting_poly(std::vector<Polygon*> *polys, vertex<int> *starting_point, int *starting_vert);
-		void update_starting_point(std::vector<Polygon*> *polys, vertex<int> *starting_point);
+		double get_min_dist(Polygon *a, Polygon *b, int *a_vert_ind, int *b_vert_ind);
+		int get_closest_vert(const vertex<int> *rect_vert, Polygon *p);
+		int get_starting_poly(std::vector<Polygon*> *polys, const vertex<int> *starting_point, int *starting_vert);
+		double get_entry_dist(const vertex<int> *point, Polygon *p);
 		void check_ids(Polygon *p);
-		int **adj_mat;
-		int **vertex_index_mat;
-		bool *visited;
 		int num_nodes;
+		std::vector<int> pos;
+		std::vector<int> unimproved;
+		std::unordered_map<uint64_t, tour_leg> legs;
 };
 
 #endif
\ No newline at end of file
@@ -1,4 +1,8 @@
 #include <string>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <sys/stat.h>
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/core.hpp>
@@ -7,130 +11,319 @@
 
 #include "polygon.hpp"
 #include "renderer.hpp"
+#include "parallel.hpp"
+
+#define SHEET_TILE_DIM 128
+#define SHEET_MAX_DIM 8192
+#define PNG_COMPRESSION 1
 
 using namespace std;
 using namespace cv;
 
 Renderer::Renderer(Slices *_my_slices) {
 	my_slices = _my_slices;
-	num_planes = my_slices->get_num_planes();
+	sheet_columns = 0;
+	sheet_tile = 0;
+	failed_layers = 0;
 }
 
 void Renderer::render(int contour_thickness, const bool show_path) {
 
 	int mat_dim = my_slices->mat_dim;
+	int num_planes = my_slices->get_num_planes();
 	Mat base = Mat(mat_dim, mat_dim, CV_8UC3, Scalar(255, 255, 255));
 	namedWindow("Slices", WINDOW_AUTOSIZE);
 	
 	int n = 0;
 	while (n < 15) {
 
-		for (int i = 0; i < num_planes; i++) {
-			
-			Mat temp = base.clone();
-			
-			Polygons *p_s = my_slices->slice_polygons[i];
-			int num_polys = p_s->get_num_polys();
-
-			assert(num_polys || i == 0 || i == num_planes - 1);
-			if (!num_polys) continue;
-
-			string level_data = "Level: " + to_string(i);
-			string poly_data = "Num polys: " + to_string(num_polys);
-			putText(temp, level_data, Point(60,30), FONT_HERSHEY_SIMPLEX, 1.0f, Scalar(0,255,0));
-			putText(temp, poly_data, Point(60,60), FONT_HERSHEY_SIMPLEX, 1.0f, Scalar(0,255,0));
-
-			if (num_polys < 2) {
-				
-				Polygon *p = p_s->get_polygon(0);
-				int num_points = p->get_size();
-
-				cv::Scalar color = Scalar(255,0,0);
-				if (p->is_open()) color = Scalar(0,0,255);
-
-				// Loop to draw polygon
-				for (int k = 0; k < num_points - 1; k++) {
-					vertex<int> *curr = p->vertices[k];
-					vertex<int> *nxt = p->vertices[k+1];
-					cv::Point start = Point(curr->x, curr->y);
-					cv::Point end = Point(nxt->x, nxt->y);
-					line(temp, start, end, color, contour_thickness);
-				}
-
-				continue;	
+		for (int i = 0; i < num_planes; i++)
+			show_layer(i, my_slices->get_layer(i), base, contour_thickness, show_path);
+		
+		n++;
+
+	}
+
+}
+
+/*
+*
+*	Shows one finished layer as soon as it's handed over, e.g. as the sink of a streaming
+*	Slices (see Slices::set_streaming)
+*
+*/
+void Renderer::render_layer(int plane_index, Polygons *layer, int contour_thickness, const bool show_path) {
+	int mat_dim = my_slices->mat_dim;
+	Mat base = Mat(mat_dim, mat_dim, CV_8UC3, Scalar(255, 255, 255));
+	namedWindow("Slices", WINDOW_AUTOSIZE);
+	show_layer(plane_index, layer, base, contour_thickness, show_path);
+}
+
+void Renderer::show_layer(int i, Polygons *p_s, const Mat &base, int contour_thickness, const bool show_path) {
+	Mat temp = base.clone();
+	draw_layer(i, p_s, temp, contour_thickness, show_path, true);
+}
+
+/*
+*
+*	Draws a layer's polygons, shells and infill (and, if show_path, its path) into temp. If
+*	animate, temp is shown in the window after each polygon; otherwise no window is needed and
+*	nothing waits
+*
+*/
+void Renderer::draw_layer(int i, Polygons *p_s, Mat &temp, int contour_thickness, const bool show_path, const bool animate) {
+
+	int num_polys = p_s->get_num_polys();
+
+	assert(num_polys || i == 0 || i == my_slices->get_num_planes() - 1);
+	if (!num_polys) return;
+
+	string level_data = "Level: " + to_string(i);
+	string poly_data = "Num polys: " + to_string(num_polys);
+	putText(temp, level_data, Point(60,30), FONT_HERSHEY_SIMPLEX, 1.0f, Scalar(0,255,0));
+	putText(temp, poly_data, Point(60,60), FONT_HERSHEY_SIMPLEX, 1.0f, Scalar(0,255,0));
+
+	// Infill goes underneath the outlines
+	for (int k = 0; k < (int) p_s->infill.size(); k++) {
+		const hatch_line *h = &p_s->infill[k];
+		line(temp, Point((int) lroundf(h->start.x), (int) lroundf(h->start.y)), Point((int) lroundf(h->end.x), (int) lroundf(h->end.y)), Scalar(200,200,200), 1);
+	}
+
+	// As do the shells
+	for (int k = 0; k < (int) p_s->shells.size(); k++) {
+		for (int j = 0; j < (int) p_s->shells[k].size(); j++) {
+			Polygon *shell = p_s->shells[k][j];
+			int n = shell->get_size();
+			for (int v = 0; v < n; v++) {
+				const vertex<int> *a = &shell->vertices[v];
+				const vertex<int> *b = &shell->vertices[(v + 1) % n];
+				line(temp, Point(a->x, a->y), Point(b->x, b->y), Scalar(0,140,255), 1);
 			}
+		}
+	}
+
+	if (num_polys < 2) {
+		
+		Polygon *p = p_s->get_polygon(0);
+		int num_points = p->get_size();
+
+		cv::Scalar color = Scalar(255,0,0);
+		if (p->is_open()) color = Scalar(0,0,255);
+
+		// Loop to draw polygon
+		for (int k = 0; k < num_points - 1; k++) {
+			vertex<int> *curr = &p->vertices[k];
+			vertex<int> *nxt = &p->vertices[k+1];
+			cv::Point start = Point(curr->x, curr->y);
+			cv::Point end = Point(nxt->x, nxt->y);
+			line(temp, start, end, color, contour_thickness);
+		}
 
+		if (show_path) draw_shell_path(p_s, temp);
+		return;
+	}
+
+	// Closed outlines aren't printed when there are shells, so the path skips them
+	bool shelled = !p_s->shells.empty();
+	vertex<int> head = p_s->test_point;
+	
+	if (show_path) circle(temp, Point(head.x, head.y), 6, Scalar(0,55,0), 3, 8);
+
+	for (int j = 0; j < num_polys; j++) {
 
-			Point start_p = Point(p_s->test_point.x, p_s->test_point.y);
+		Polygon *p = p_s->get_polygon(p_s->path->order[j]);
+		int num_points = p->get_size();
 
-			int first_poly_ind = p_s->path->order[0];
-			Polygon *first_p = p_s->get_polygon(first_poly_ind);
-			Point first_vert = Point(first_p->vertices[first_p->start_index]->x, first_p->vertices[first_p->start_index]->y);
+		cv::Scalar color = Scalar(255,0,0);
+		if (p->is_open()) color = Scalar(0,0,255);
+
+		// Loop to draw polygon
+		for (int k = 0; k < num_points - 1; k++) {
+			vertex<int> *curr = &p->vertices[k];
+			vertex<int> *nxt = &p->vertices[k+1];
+			cv::Point start = Point(curr->x, curr->y);
+			cv::Point end = Point(nxt->x, nxt->y);
+			line(temp, start, end, color, contour_thickness);
+		}
+
+		if (show_path && (!shelled || p->is_open())) {
 			
-			if (show_path) {
-				circle(temp, start_p, 6, Scalar(0,55,0), 3, 8);
-				arrowedLine(temp, start_p, first_vert, Scalar(0,255,0), 1);
-			}
+			int start_ind = p->start_index;
+			int end_ind = p->end_index;
 
-			for (int j = 0; j < num_polys; j++) {
-
-				int prev_poly_ind, curr_poly_ind, nxt_poly_ind;
-				if (j > 0) prev_poly_ind = p_s->path->order[j - 1];
-				curr_poly_ind = p_s->path->order[j];
-				if (j < num_polys - 1) nxt_poly_ind = p_s->path->order[j + 1];
-
-				Polygon *p = p_s->get_polygon(curr_poly_ind);
-				int num_points = p->get_size();
-
-				cv::Scalar color = Scalar(255,0,0);
-				if (p->is_open()) color = Scalar(0,0,255);
-
-				// Loop to draw polygon
-				for (int k = 0; k < num_points - 1; k++) {
-					vertex<int> *curr = p->vertices[k];
-					vertex<int> *nxt = p->vertices[k+1];
-					cv::Point start = Point(curr->x, curr->y);
-					cv::Point end = Point(nxt->x, nxt->y);
-					line(temp, start, end, color, contour_thickness);
-				}
-
-				if (show_path) {
-					
-					int start_ind = p->start_index;
-					int end_ind = p->end_index;
-
-					vertex<int> *start = p->vertices[start_ind];
-					vertex<int> *end = p->vertices[end_ind];
-
-					circle(temp, Point(start->x, start->y), 4, Scalar(0,255,0), 2, 8);
-					circle(temp, Point(end->x + 1, end->y + 1), 4, Scalar(0,0,255), 2, 8);
-
-					// Point a0 = Point(p->bounding_rect[0].x - 1, p->bounding_rect[0].y - 1);
-					// Point a2 = Point(p->bounding_rect[2].x + 1, p->bounding_rect[2].y + 1);
-					// rectangle(temp, a0, a2, Scalar(0,50,0), 1, 8);
-
-					if (j > 0) {
-						Polygon *prev_poly = p_s->get_polygon(prev_poly_ind);
-						vertex<int> *prev_vertex = prev_poly->vertices[prev_poly->end_index];
-						Point avg_pt = Point(start->x + prev_vertex->x, start->y + prev_vertex->y);
-						arrowedLine(temp, Point(prev_vertex->x, prev_vertex->y), Point(start->x, start->y), Scalar(0,255,0), 1);
-					}
-				}
-				
-				imshow("Slices", temp);
-				if (show_path) waitKey(50);
+			vertex<int> *start = &p->vertices[start_ind];
+			vertex<int> *end = &p->vertices[end_ind];
 
-			}
+			circle(temp, Point(start->x, start->y), 4, Scalar(0,255,0), 2, 8);
+			circle(temp, Point(end->x + 1, end->y + 1), 4, Scalar(0,0,255), 2, 8);
+
+			// Point a0 = Point(p->bounding_rect[0].x - 1, p->bounding_rect[0].y - 1);
+			// Point a2 = Point(p->bounding_rect[2].x + 1, p->bounding_rect[2].y + 1);
+			// rectangle(temp, a0, a2, Scalar(0,50,0), 1, 8);
 
-			waitKey(20);
-				
+			arrowedLine(temp, Point(head.x, head.y), Point(start->x, start->y), Scalar(0,255,0), 1);
+			head = *end;
 		}
 		
-		n++;
+		if (animate) {
+			imshow("Slices", temp);
+			if (show_path) waitKey(50);
+		}
+
+	}
+
+	if (show_path) draw_shell_path(p_s, temp);
+
+	if (animate) waitKey(20);
 
+}
+
+/*
+*
+*	Draws the path through the layer's shells (see Polygons::plan_shells): an arrow from the
+*	head into each ring, in the order they're printed, and a circle where it's entered
+*
+*/
+void Renderer::draw_shell_path(Polygons *p_s, Mat &temp) {
+
+	vertex<int> head;
+	p_s->get_shell_entry(&head);
+
+	for (int k = 0; k < (int) p_s->shells.size(); k++) {
+		vector<Polygon*> *rings = &p_s->shells[k];
+		int num_rings = (int) rings->size();
+		for (int j = 0; j < num_rings; j++) {
+			Polygon *ring = (*rings)[num_rings > 1 ? p_s->shell_orders[k][j] : 0];
+			if (!ring->get_size()) continue;
+			vertex<int> *start = &ring->vertices[ring->start_index];
+			circle(temp, Point(start->x, start->y), 4, Scalar(0,255,0), 2, 8);
+			arrowedLine(temp, Point(head.x, head.y), Point(start->x, start->y), Scalar(0,255,0), 1);
+			head = *start;
+		}
 	}
 
 }
 
+/*
+*
+*	Headless export: each layer is drawn offscreen (no window, no waits) and written to
+*	dir/layer_<n>.png, and a scaled-down copy of it is placed on a contact sheet of every layer,
+*	written to dir/sheet.png by end_export. Returns 0 if dir can't be created
+*
+*/
+int Renderer::begin_export(string dir) {
+	export_dir = dir;
+	sheet.release();
+	sheet_columns = 0;
+	failed_layers = 0;
+	struct stat dir_stat;
+	if (mkdir(dir.c_str(), 0755) != 0 && (stat(dir.c_str(), &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode))) return 0;
+	return 1;
+}
+
+/*
+*
+*	Exports every layer, drawing and encoding them in parallel (see export_batch). Layers are
+*	fetched first, in order, since Slices::get_layer may slice or load a layer the first time
+*	it's asked for. Returns 0 if any file couldn't be written
+*
+*/
+int Renderer::export_layers(int contour_thickness, const bool show_path, int num_threads) {
+	int num_planes = my_slices->get_num_planes();
+	vector<Polygons*> layers(num_planes);
+	for (int i = 0; i < num_planes; i++)
+		layers[i] = my_slices->get_layer(i);
+	return export_batch(0, &layers, contour_thickness, show_path, num_threads);
+}
+
+/*
+*
+*	Exports a run of finished layers, starting at plane first_plane, drawing and encoding them
+*	in parallel, e.g. as the batch sink of a streaming Slices (see Slices::set_streaming).
+*	Returns 0 if any of their files couldn't be written
+*
+*/
+int Renderer::export_batch(int first_plane, vector<Polygons*> *layers, int contour_thickness, const bool show_path, int num_threads) {
+
+	int mat_dim = my_slices->mat_dim;
+	Mat base = Mat(mat_dim, mat_dim, CV_8UC3, Scalar(255, 255, 255));
+	if (sheet.empty()) init_sheet();
+
+	num_threads = get_num_threads(num_threads);
+	vector<Mat> images(num_threads);
+	atomic<int> failed(0);
+	parallel_for_each((int) layers->size(), num_threads, [&](int i, int t) {
+		base.copyTo(images[t]);
+		draw_layer(first_plane + i, (*layers)[i], images[t], contour_thickness, show_path, false);
+		if (!write_layer(first_plane + i, images[t])) failed++;
+	});
+
+	return failed == 0;
+
+}
+
+/*
+*
+*	Exports one finished layer as soon as it's handed over, e.g. as the sink of a streaming
+*	Slices (see Slices::set_streaming). Returns 0 if its file couldn't be written
+*
+*/
+int Renderer::export_layer(int plane_index, Polygons *layer, int contour_thickness, const bool show_path) {
+	int mat_dim = my_slices->mat_dim;
+	Mat image = Mat(mat_dim, mat_dim, CV_8UC3, Scalar(255, 255, 255));
+	if (sheet.empty()) init_sheet();
+	draw_layer(plane_index, layer, image, contour_thickness, show_path, false);
+	return write_layer(plane_index, image);
+}
+
+/*
+*
+*	Writes the contact sheet. Returns 0 if it, or any layer exported since begin_export,
+*	couldn't be written
+*
+*/
+int Renderer::end_export() {
+	if (failed_layers > 0) return 0;
+	if (sheet.empty()) return 1;
+	vector<int> params = { IMWRITE_PNG_COMPRESSION, PNG_COMPRESSION };
+	return imwrite(export_dir + "/sheet.png", sheet, params) ? 1 : 0;
+}
+
+/*
+*
+*	Writes one drawn layer and copies it, scaled down, onto its tile of the contact sheet.
+*	Each layer has its own tile, so layers can be written from several threads at once
+*
+*/
+int Renderer::write_layer(int plane_index, const Mat &image) {
+
+	char name[32];
+	snprintf(name, sizeof(name), "/layer_%05d.png", plane_index);
+	vector<int> params = { IMWRITE_PNG_COMPRESSION, PNG_COMPRESSION };
+	int written = imwrite(export_dir + name, image, params) ? 1 : 0;
+	if (!written) failed_layers++;
+
+	if (plane_index < my_slices->get_num_planes()) {
+		int x = (plane_index % sheet_columns) * sheet_tile;
+		int y = (plane_index / sheet_columns) * sheet_tile;
+		Mat tile = sheet(Rect(x, y, sheet_tile, sheet_tile));
+		resize(image, tile, tile.size(), 0, 0, INTER_AREA);
+	}
+
+	return written;
 
+}
 
+/*
+*
+*	Lays the contact sheet out as a near-square grid of tiles, one per plane. Tiles shrink for
+*	models with many planes so that the sheet stays at most SHEET_MAX_DIM pixels across
+*
+*/
+void Renderer::init_sheet() {
+	int num_planes = max(my_slices->get_num_planes(), 1);
+	sheet_columns = (int) ceil(sqrt((double) num_planes));
+	sheet_tile = max(1, min(SHEET_TILE_DIM, SHEET_MAX_DIM / sheet_columns));
+	int rows = (num_planes + sheet_columns - 1) / sheet_columns;
+	sheet = Mat(rows * sheet_tile, sheet_columns * sheet_tile, CV_8UC3, Scalar(255, 255, 255));
+}
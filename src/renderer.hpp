@@ -1,15 +1,33 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <string>
+#include <vector>
+#include <atomic>
 #include "slices.hpp"
 
 class Renderer {
 	public:
 		Renderer(Slices *_my_slices);
 		void render(int contour_thickness, const bool show_path);
+		void render_layer(int plane_index, Polygons *layer, int contour_thickness, const bool show_path);
+		int begin_export(std::string dir);
+		int export_layers(int contour_thickness, const bool show_path, int num_threads);
+		int export_batch(int first_plane, std::vector<Polygons*> *layers, int contour_thickness, const bool show_path, int num_threads);
+		int export_layer(int plane_index, Polygons *layer, int contour_thickness, const bool show_path);
+		int end_export();
 	private:
+		void show_layer(int i, Polygons *p_s, const cv::Mat &base, int contour_thickness, const bool show_path);
+		void draw_layer(int i, Polygons *p_s, cv::Mat &temp, int contour_thickness, const bool show_path, const bool animate);
+		void draw_shell_path(Polygons *p_s, cv::Mat &temp);
+		int write_layer(int plane_index, const cv::Mat &image);
+		void init_sheet();
 		Slices *my_slices;
-		int num_planes;
+		std::string export_dir;
+		cv::Mat sheet;
+		int sheet_columns;
+		int sheet_tile;
+		std::atomic<int> failed_layers;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include <math.h>
+#include <assert.h>
+#include <limits>
+#include <algorithm>
+#include "segbvh.hpp"
+
+#define BVH_LEAF_SIZE 4
+
+using namespace std;
+
+/*
+*
+*	A SegmentBVH is a bounding volume hierarchy over the segments of a polygon (vertex i to
+*	vertex i + 1, plus the closing segment for closed polygons), so that the closest pair of
+*	vertices of two polygons can be found by descending both hierarchies together and skipping
+*	pairs of boxes that are further apart than the best pair found so far
+*
+*/
+SegmentBVH::SegmentBVH() {
+	vertices = nullptr;
+	num_segs = 0;
+	built = false;
+}
+
+void SegmentBVH::build(const vector<vertex<int> > *_vertices, bool closed) {
+
+	vertices = _vertices;
+	int n = (int) vertices->size();
+	assert(n > 0);
+	num_segs = (closed || n == 1) ? n : n - 1;
+
+	segs.resize(num_segs);
+	for (int i = 0; i < num_segs; i++)
+		segs[i] = i;
+
+	nodes.clear();
+	nodes.reserve(2 * (num_segs / BVH_LEAF_SIZE + 1));
+	build_node(0, num_segs);
+	built = true;
+
+}
+
+void SegmentBVH::clear() {
+	nodes.clear();
+	segs.clear();
+	num_segs = 0;
+	built = false;
+}
+
+bool SegmentBVH::is_built() { return built; }
+
+/*
+*
+*	Builds the node for segs[first, first + count), splitting at the median segment midpoint
+*	along the longer side of its box, and returns the node's index
+*
+*/
+int SegmentBVH::build_node(int first, int count) {
+
+	int index = (int) nodes.size();
+	nodes.push_back(bvh_node());
+
+	int box[4] = { numeric_limits<int>::max(), numeric_limits<int>::lowest(), numeric_limits<int>::max(), numeric_limits<int>::lowest() };
+	for (int k = first; k < first + count; k++) {
+		const vertex<int> *p, *q;
+		get_segment(segs[k], &p, &q);
+		box[0] = min(box[0], min(p->x, q->x));
+		box[1] = max(box[1], max(p->x, q->x));
+		box[2] = min(box[2], min(p->y, q->y));
+		box[3] = max(box[3], max(p->y, q->y));
+	}
+
+	int left = -1, right = -1;
+	if (count > BVH_LEAF_SIZE) {
+		bool split_x = box[1] - box[0] >= box[3] - box[2];
+		int mid = first + count / 2;
+		nth_element(segs.begin() + first, segs.begin() + mid, segs.begin() + first + count, [this, split_x](int s, int t) {
+			const vertex<int> *p0, *p1, *q0, *q1;
+			get_segment(s, &p0, &p1);
+			get_segment(t, &q0, &q1);
+			if (split_x) return p0->x + p1->x < q0->x + q1->x;
+			return p0->y + p1->y < q0->y + q1->y;
+		});
+		left = build_node(first, mid - first);
+		right = build_node(mid, first + count - mid);
+	}
+
+	bvh_node *node = &nodes[index];
+	for (int j = 0; j < 4; j++)
+		node->box[j] = box[j];
+	node->left = left;
+	node->right = right;
+	node->first = first;
+	node->count = count;
+	return index;
+
+}
+
+void SegmentBVH::get_segment(int seg, const vertex<int> **p, const vertex<int> **q) {
+	int n = (int) vertices->size();
+	*p = &(*vertices)[seg];
+	*q = &(*vertices)[(seg + 1) % n];
+}
+
+/*
+*
+*	Returns the distance between the closest pair of vertices of two polygons, and stores
+*	their indices in the int pointer args. A segment's box holds both of its endpoints, so pairs
+*	of boxes further apart than the closest pair found so far can't hold a closer one
+*
+*/
+double SegmentBVH::get_min_dist(SegmentBVH *a, SegmentBVH *b, int *a_vert_ind, int *b_vert_ind) {
+
+	assert(a->built && b->built);
+
+	int64_t best = numeric_limits<int64_t>::max();
+	int na = (int) a->vertices->size(), nb = (int) b->vertices->size();
+
+	vector<pair<int, int> > stack;
+	stack.push_back(make_pair(0, 0));
+
+	while (!stack.empty() && best > 0) {
+
+		int ia = stack.back().first, ib = stack.back().second;
+		stack.pop_back();
+		bvh_node *node_a = &a->nodes[ia];
+		bvh_node *node_b = &b->nodes[ib];
+
+		if (get_box_dist(node_a->box, node_b->box) >= best) continue;
+
+		bool a_leaf = node_a->left < 0, b_leaf = node_b->left < 0;
+		if (a_leaf && b_leaf) {
+			for (int i = node_a->first; i < node_a->first + node_a->count; i++) {
+				for (int ei = 0; ei < 2; ei++) {
+					int va = (a->segs[i] + ei) % na;
+					const vertex<int> *p = &(*a->vertices)[va];
+					for (int j = node_b->first; j < node_b->first + node_b->count; j++) {
+						for (int ej = 0; ej < 2; ej++) {
+							int vb = (b->segs[j] + ej) % nb;
+							const vertex<int> *q = &(*b->vertices)[vb];
+							int64_t dx = (int64_t) p->x - q->x, dy = (int64_t) p->y - q->y;
+							if (dx * dx + dy * dy < best) {
+								best = dx * dx + dy * dy;
+								*a_vert_ind = va;
+								*b_vert_ind = vb;
+							}
+						}
+					}
+				}
+			}
+			continue;
+		}
+
+		// Descend into the bigger of the two boxes, pushing the nearer child last so it's
+		// searched first
+		int64_t area_a = (int64_t) (node_a->box[1] - node_a->box[0]) * (node_a->box[3] - node_a->box[2]);
+		int64_t area_b = (int64_t) (node_b->box[1] - node_b->box[0]) * (node_b->box[3] - node_b->box[2]);
+		if (b_leaf || (!a_leaf && area_a >= area_b)) {
+			int near_child = node_a->left, far_child = node_a->right;
+			if (get_box_dist(a->nodes[far_child].box, node_b->box) < get_box_dist(a->nodes[near_child].box, node_b->box)) swap(near_child, far_child);
+			stack.push_back(make_pair(far_child, ib));
+			stack.push_back(make_pair(near_child, ib));
+		} else {
+			int near_child = node_b->left, far_child = node_b->right;
+			if (get_box_dist(node_a->box, b->nodes[far_child].box) < get_box_dist(node_a->box, b->nodes[near_child].box)) swap(near_child, far_child);
+			stack.push_back(make_pair(ia, far_child));
+			stack.push_back(make_pair(ia, near_child));
+		}
+
+	}
+
+	return sqrt((double) best);
+
+}
+
+/*
+*
+*	Squared distance between two boxes (0 if they overlap)
+*
+*/
+int64_t SegmentBVH::get_box_dist(const int *a, const int *b) {
+	int64_t dx = max(0, max(a[0] - b[1], b[0] - a[1]));
+	int64_t dy = max(0, max(a[2] - b[3], b[2] - a[3]));
+	return dx * dx + dy * dy;
+}
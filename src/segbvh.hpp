@@ -0,0 +1,34 @@
+#ifndef SEGBVH_H
+#define SEGBVH_H
+
+#include <vector>
+#include <stdint.h>
+#include "vertex.hpp"
+
+struct bvh_node {
+	int box[4];
+	int left;
+	int right;
+	int first;
+	int count;
+};
+
+class SegmentBVH {
+	public:
+		SegmentBVH();
+		void build(const std::vector<vertex<int> > *_vertices, bool closed);
+		void clear();
+		bool is_built();
+		static double get_min_dist(SegmentBVH *a, SegmentBVH *b, int *a_vert_ind, int *b_vert_ind);
+	private:
+		int build_node(int first, int count);
+		void get_segment(int seg, const vertex<int> **p, const vertex<int> **q);
+		static int64_t get_box_dist(const int *a, const int *b);
+		const std::vector<vertex<int> > *vertices;
+		std::vector<bvh_node> nodes;
+		std::vector<int> segs;
+		int num_segs;
+		bool built;
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include <math.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <queue>
+#include <functional>
+#include "simplify.hpp"
+
+#define SIMPLIFY_MAX_UNBALANCED 256
+
+using namespace std;
+
+/*
+*
+*	A Simplifier drops polyline vertices that lie within tolerance of the line through the
+*	vertices kept on either side of them, converting chains of short segments that closely
+*	approximate a line segment into a single segment. The first and last vertices are always
+*	kept. Vertices are marked in one pass of the chosen algorithm and the survivors are then
+*	compacted in place, so no vertex is moved more than once
+*
+*/
+Simplifier::Simplifier(int _algorithm, double _tolerance) {
+	algorithm = _algorithm;
+	tolerance = _tolerance;
+}
+
+void Simplifier::simplify(vector<vertex<int> > *vertices) {
+
+	int n = (int) vertices->size();
+	if (n < 3) return;
+
+	keep.assign(n, 0);
+	keep[0] = keep[n - 1] = 1;
+
+	if (algorithm == SIMPLIFY_VISVALINGAM) visvalingam(vertices);
+	else douglas_peucker(vertices);
+
+	compact(vertices);
+
+}
+
+/*
+*
+*	Douglas-Peucker: keeps the vertex furthest from the line through the ends of a range if it's
+*	further than tolerance, and splits the range there. Ranges wait on an explicit stack rather
+*	than in recursive calls, so long contours can't overflow the call stack. Every dropped vertex
+*	ends up within tolerance of the line through its kept neighbours.
+*	Each range costs one distance per vertex in it, so splits that keep landing near an end (a
+*	spiral, say) would make the pass quadratic. A range longer than SIMPLIFY_MAX_UNBALANCED split
+*	in its outer quarters is split at its middle vertex too, so long ranges shrink to at most
+*	three quarters at every split. That bounds the pass to O(n log n) distances, plus at most
+*	SIMPLIFY_MAX_UNBALANCED per vertex in the short ranges, at the price of a middle vertex that
+*	may not have been needed
+*
+*/
+void Simplifier::douglas_peucker(const vector<vertex<int> > *vertices) {
+
+	ranges.clear();
+	ranges.push_back(make_pair(0, (int) vertices->size() - 1));
+
+	while (!ranges.empty()) {
+
+		int i = ranges.back().first;
+		int j = ranges.back().second;
+		ranges.pop_back();
+		if (j - i < 2) continue;
+
+		// Ties go to the vertex nearest the middle of the range. Staircase contours (e.g. a shallow
+		// slope traced by findContours) have many equally distant vertices, and always splitting
+		// at the first of them would make the whole pass quadratic
+		int furthest = -1;
+		int mid = (i + j) / 2;
+		double max_dist = tolerance;
+		for (int k = i + 1; k < j; k++) {
+			double dist = get_line_dist(&(*vertices)[k], &(*vertices)[i], &(*vertices)[j]);
+			if (dist > max_dist || (dist == max_dist && furthest >= 0 && abs(k - mid) < abs(furthest - mid))) {
+				max_dist = dist;
+				furthest = k;
+			}
+		}
+
+		if (furthest < 0) continue;
+		keep[furthest] = 1;
+		if (j - i > SIMPLIFY_MAX_UNBALANCED && 4 * min(furthest - i, j - furthest) < j - i) {
+			keep[mid] = 1;
+			int first = min(furthest, mid);
+			int second = max(furthest, mid);
+			ranges.push_back(make_pair(second, j));
+			ranges.push_back(make_pair(first, second));
+			ranges.push_back(make_pair(i, first));
+			continue;
+		}
+		ranges.push_back(make_pair(furthest, j));
+		ranges.push_back(make_pair(i, furthest));
+
+	}
+
+}
+
+/*
+*
+*	Visvalingam-style: repeatedly drops the vertex closest to the line through its current
+*	neighbours, as long as that distance is within tolerance, using a heap with lazy deletion
+*	of outdated entries. Tends to keep fewer vertices than Douglas-Peucker on noisy contours,
+*	but a dropped vertex is only guaranteed to be within tolerance of the line it was dropped
+*	against, not of the final one
+*
+*/
+void Simplifier::visvalingam(const vector<vertex<int> > *vertices) {
+
+	int n = (int) vertices->size();
+	prev.resize(n);
+	next.resize(n);
+	key.resize(n);
+
+	typedef pair<double, int> entry;
+	priority_queue<entry, vector<entry>, greater<entry> > heap;
+	keep.assign(n, 1);
+
+	for (int k = 0; k < n; k++) {
+		prev[k] = k - 1;
+		next[k] = k + 1;
+	}
+	for (int k = 1; k < n - 1; k++) {
+		key[k] = get_line_dist(&(*vertices)[k], &(*vertices)[k - 1], &(*vertices)[k + 1]);
+		heap.push(make_pair(key[k], k));
+	}
+
+	while (!heap.empty()) {
+
+		entry top = heap.top();
+		heap.pop();
+		int k = top.second;
+		if (!keep[k] || top.first != key[k]) continue;
+		if (top.first > tolerance) break;
+
+		keep[k] = 0;
+		int p = prev[k], q = next[k];
+		next[p] = q;
+		prev[q] = p;
+
+		if (p > 0) {
+			key[p] = get_line_dist(&(*vertices)[p], &(*vertices)[prev[p]], &(*vertices)[q]);
+			heap.push(make_pair(key[p], p));
+		}
+		if (q < n - 1) {
+			key[q] = get_line_dist(&(*vertices)[q], &(*vertices)[p], &(*vertices)[next[q]]);
+			heap.push(make_pair(key[q], q));
+		}
+
+	}
+
+}
+
+/*
+*
+*	Moves the kept vertices to the front of the vector, in order, and drops the rest
+*
+*/
+void Simplifier::compact(vector<vertex<int> > *vertices) {
+	int n = (int) vertices->size();
+	int kept = 0;
+	for (int k = 0; k < n; k++) {
+		if (keep[k]) (*vertices)[kept++] = (*vertices)[k];
+	}
+	vertices->resize(kept);
+}
+
+/*
+*
+*	Distance from p to the (infinite) line through a and b, or to a if a and b coincide
+*
+*/
+double Simplifier::get_line_dist(const vertex<int> *p, const vertex<int> *a, const vertex<int> *b) {
+	double dx = (double) (b->x - a->x);
+	double dy = (double) (b->y - a->y);
+	double len = sqrt(dx * dx + dy * dy);
+	double px = (double) (p->x - a->x);
+	double py = (double) (p->y - a->y);
+	if (len == 0) return sqrt(px * px + py * py);
+	return fabs(dx * py - dy * px) / len;
+}
@@ -0,0 +1,29 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <vector>
+#include <utility>
+#include "vertex.hpp"
+
+#define SIMPLIFY_DOUGLAS_PEUCKER 0
+#define SIMPLIFY_VISVALINGAM 1
+
+class Simplifier {
+	public:
+		Simplifier(int _algorithm, double _tolerance);
+		void simplify(std::vector<vertex<int> > *vertices);
+	private:
+		void douglas_peucker(const std::vector<vertex<int> > *vertices);
+		void visvalingam(const std::vector<vertex<int> > *vertices);
+		void compact(std::vector<vertex<int> > *vertices);
+		static double get_line_dist(const vertex<int> *p, const vertex<int> *a, const vertex<int> *b);
+		int algorithm;
+		double tolerance;
+		std::vector<char> keep;
+		std::vector<std::pair<int, int> > ranges;
+		std::vector<int> prev;
+		std::vector<int> next;
+		std::vector<double> key;
+};
+
+#endif
@@ -0,0 +1,380 @@
+#include <assert.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "slicecache.hpp"
+
+#define CACHE_MAGIC 0x434c5353
+#define CACHE_VERSION 1
+#define CACHE_PRIME 1099511628211ULL
+#define CACHE_FOLD 29
+#define CACHE_WRITE_BUFFER (1 << 20)
+
+using namespace std;
+
+/*
+*
+*	A SliceCache keeps finished slices in one binary layer file per cache key (a hash of the
+*	mesh file and every setting that changes the output) in dir. The file starts with a header
+*	and a table giving each layer's offset and counts, followed by each layer's contours,
+*	polygons and path order as flat arrays of int32s. An existing file is memory-mapped and
+*	layers are copied out of it with no parsing, only when they're asked for
+*
+*/
+SliceCache::SliceCache(string _dir) {
+	dir = _dir;
+	key = 0;
+	file_map = NULL;
+	file_size = 0;
+	header = NULL;
+	layers = NULL;
+	out = NULL;
+	out_offset = 0;
+	out_ok = false;
+}
+
+/*
+*
+*	FNV-1a style hash, taken a 64-bit word at a time (then byte by byte for the tail), so that
+*	large meshes hash at close to memory speed. Multiplying only carries bits upwards, so each
+*	word's product is folded back down before the next word; otherwise a word's top bit (e.g.
+*	the sign of every other float in an STL) would never reach the rest of the hash, and two
+*	words differing only there would cancel out. Chain calls through seed to hash several values
+*
+*/
+uint64_t SliceCache::hash(const void *data, size_t size, uint64_t seed) {
+	const unsigned char *bytes = (const unsigned char *) data;
+	uint64_t h = seed;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		h = (h ^ word) * CACHE_PRIME;
+		h ^= h >> CACHE_FOLD;
+	}
+	for (; i < size; i++)
+		h = (h ^ bytes[i]) * CACHE_PRIME;
+	return h;
+}
+
+int SliceCache::hash_file(string filename, uint64_t *out) {
+
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return 0;
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) < 0) {
+		::close(fd);
+		return 0;
+	}
+
+	size_t size = (size_t) file_stat.st_size;
+	if (!size) {
+		::close(fd);
+		*out = hash(NULL, 0);
+		return 1;
+	}
+
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) return 0;
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	*out = hash(map, size);
+	munmap(map, size);
+	return 1;
+
+}
+
+string SliceCache::get_path() {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.slices", (unsigned long long) key);
+	return dir + "/" + name;
+}
+
+/*
+*
+*	Maps the layer file for _key, if there is a valid one. Either way, the key is kept for
+*	begin_write
+*
+*/
+bool SliceCache::open(uint64_t _key) {
+
+	close();
+	key = _key;
+
+	int fd = ::open(get_path().c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) < 0 || (size_t) file_stat.st_size < sizeof(cache_header)) {
+		::close(fd);
+		return false;
+	}
+
+	file_size = (size_t) file_stat.st_size;
+	void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) {
+		file_size = 0;
+		return false;
+	}
+	file_map = (const char *) map;
+	header = (const cache_header *) file_map;
+	layers = (const cache_layer *) (file_map + sizeof(cache_header));
+
+	if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION || header->key != key || !check_layers()) {
+		close();
+		return false;
+	}
+
+	return true;
+
+}
+
+/*
+*
+*	Checks that the layer table and every layer it points to lie within the file, and that
+*	each layer's contour and polygon sizes add up to its counts (see check_layer), so that
+*	load_layer never reads past a layer however the file was damaged
+*
+*/
+bool SliceCache::check_layers() {
+
+	if (header->num_planes < 0) return false;
+	uint64_t table_end = sizeof(cache_header) + (uint64_t) header->num_planes * sizeof(cache_layer);
+	if (table_end > file_size) return false;
+
+	for (int i = 0; i < header->num_planes; i++) {
+		const cache_layer *l = &layers[i];
+		if (l->num_contours < 0 || l->num_contour_points < 0 || l->num_polys < 0 || l->num_poly_vertices < 0 || l->num_order < 0)
+			return false;
+		uint64_t count = (uint64_t) l->num_contours + 2 * (uint64_t) l->num_contour_points + 3 * (uint64_t) l->num_polys +
+			2 * (uint64_t) l->num_poly_vertices + (uint64_t) l->num_order;
+		if (l->offset % 4 || l->offset < table_end || l->offset > file_size || 4 * count > file_size - l->offset)
+			return false;
+		if (!check_layer(l)) return false;
+	}
+
+	return true;
+
+}
+
+/*
+*
+*	Checks one layer's contents, already known to lie within the file: contour sizes that sum
+*	to num_contour_points, polygon sizes that sum to num_poly_vertices with start and end
+*	indices inside their polygons, and a path order that only names its polygons
+*
+*/
+bool SliceCache::check_layer(const cache_layer *l) {
+
+	const int32_t *data = (const int32_t *) (file_map + l->offset);
+
+	const int32_t *contour_sizes = data;
+	uint64_t total = 0;
+	for (int c = 0; c < l->num_contours; c++) {
+		if (contour_sizes[c] < 0) return false;
+		total += (uint64_t) contour_sizes[c];
+	}
+	if (total != (uint64_t) l->num_contour_points) return false;
+
+	const int32_t *poly_info = contour_sizes + l->num_contours + 2 * (size_t) l->num_contour_points;
+	total = 0;
+	for (int p = 0; p < l->num_polys; p++) {
+		int32_t n = poly_info[3 * p];
+		int32_t start = poly_info[3 * p + 1];
+		int32_t end = poly_info[3 * p + 2];
+		if (n < 0 || start < -1 || start >= n || end < -1 || end >= n) return false;
+		total += (uint64_t) n;
+	}
+	if (total != (uint64_t) l->num_poly_vertices) return false;
+
+	if (l->num_polys > 1 && l->num_order != l->num_polys) return false;
+	const int32_t *order = poly_info + 3 * (size_t) l->num_polys + 2 * (size_t) l->num_poly_vertices;
+	for (int k = 0; k < l->num_order; k++) {
+		if (order[k] < 0 || order[k] >= l->num_polys) return false;
+	}
+
+	return true;
+
+}
+
+bool SliceCache::is_open() { return file_map != NULL; }
+
+int SliceCache::get_num_planes() { return header->num_planes; }
+
+int SliceCache::get_mat_dim() { return header->mat_dim; }
+
+float SliceCache::get_slice_thickness() { return header->slice_thickness; }
+
+/*
+*
+*	Rebuilds one layer, already re-rooted, from the mapped file, filling in its contours. The
+*	layer's sizes were validated when the file was opened (see check_layer)
+*
+*/
+Polygons* SliceCache::load_layer(int plane_index, vector<vector<cv::Point> > *contours) {
+
+	assert(is_open() && plane_index >= 0 && plane_index < header->num_planes);
+	const cache_layer *l = &layers[plane_index];
+	const int32_t *data = (const int32_t *) (file_map + l->offset);
+
+	const int32_t *contour_sizes = data;
+	const int32_t *points = contour_sizes + l->num_contours;
+	contours->resize(l->num_contours);
+	int total = 0;
+	for (int c = 0; c < l->num_contours; c++) {
+		int n = contour_sizes[c];
+		assert(n >= 0 && total + n <= l->num_contour_points);
+		(*contours)[c].resize(n);
+		const int32_t *p = points + 2 * (size_t) total;
+		for (int k = 0; k < n; k++)
+			(*contours)[c][k] = cv::Point(p[2 * k], p[2 * k + 1]);
+		total += n;
+	}
+
+	const int32_t *poly_info = points + 2 * (size_t) l->num_contour_points;
+	const int32_t *vertices = poly_info + 3 * (size_t) l->num_polys;
+	vector<Polygon*> polys(l->num_polys);
+	total = 0;
+	for (int p = 0; p < l->num_polys; p++) {
+		int n = poly_info[3 * p];
+		assert(n >= 0 && total + n <= l->num_poly_vertices);
+		polys[p] = new Polygon((const vertex<int> *) (vertices + 2 * (size_t) total), n, poly_info[3 * p + 1], poly_info[3 * p + 2]);
+		total += n;
+	}
+
+	const int32_t *order_data = vertices + 2 * (size_t) l->num_poly_vertices;
+	vector<int> order(order_data, order_data + l->num_order);
+	vertex<int> test_point;
+	test_point.x = l->test_point[0];
+	test_point.y = l->test_point[1];
+
+	return new Polygons(&polys, &order, &test_point);
+
+}
+
+/*
+*
+*	Starts a layer file for the key given to open. Layers are written to a temporary file and
+*	the table is filled in by end_write, which then moves the file into place, so a cache file
+*	is either complete or absent
+*
+*/
+bool SliceCache::begin_write(int num_planes, int mat_dim, float slice_thickness) {
+
+	mkdir(dir.c_str(), 0755);
+	out_path = get_path() + ".tmp." + to_string((long long) getpid());
+	out = fopen(out_path.c_str(), "wb");
+	if (!out) return false;
+
+	out_buffer.resize(CACHE_WRITE_BUFFER);
+	setvbuf(out, &out_buffer[0], _IOFBF, out_buffer.size());
+
+	cache_header h;
+	memset(&h, 0, sizeof(h));
+	h.magic = CACHE_MAGIC;
+	h.version = CACHE_VERSION;
+	h.key = key;
+	h.num_planes = num_planes;
+	h.mat_dim = mat_dim;
+	h.slice_thickness = slice_thickness;
+
+	cache_layer empty;
+	memset(&empty, 0, sizeof(empty));
+	out_layers.assign(num_planes, empty);
+
+	out_ok = fwrite(&h, sizeof(h), 1, out) == 1;
+	if (num_planes) out_ok = out_ok && fwrite(&out_layers[0], sizeof(cache_layer), out_layers.size(), out) == out_layers.size();
+	out_offset = sizeof(h) + (uint64_t) num_planes * sizeof(cache_layer);
+	for (int i = 0; i < num_planes; i++)
+		out_layers[i].offset = out_offset;
+	return out_ok;
+
+}
+
+bool SliceCache::is_writing() { return out != NULL; }
+
+void SliceCache::write_layer(int plane_index, Polygons *layer, const vector<vector<cv::Point> > *contours) {
+
+	assert(is_writing() && plane_index >= 0 && plane_index < (int) out_layers.size());
+	cache_layer *l = &out_layers[plane_index];
+	vector<int32_t> data;
+
+	l->offset = out_offset;
+	l->num_contours = (int32_t) contours->size();
+	l->num_contour_points = 0;
+	for (int c = 0; c < l->num_contours; c++) {
+		data.push_back((int32_t) (*contours)[c].size());
+		l->num_contour_points += (int32_t) (*contours)[c].size();
+	}
+	for (int c = 0; c < l->num_contours; c++) {
+		for (int k = 0; k < (int) (*contours)[c].size(); k++) {
+			data.push_back((*contours)[c][k].x);
+			data.push_back((*contours)[c][k].y);
+		}
+	}
+
+	l->num_polys = layer->get_num_polys();
+	l->num_poly_vertices = 0;
+	for (int p = 0; p < l->num_polys; p++) {
+		Polygon *poly = layer->get_polygon(p);
+		data.push_back(poly->get_size());
+		data.push_back(poly->start_index);
+		data.push_back(poly->end_index);
+		l->num_poly_vertices += poly->get_size();
+	}
+	for (int p = 0; p < l->num_polys; p++) {
+		Polygon *poly = layer->get_polygon(p);
+		for (int k = 0; k < poly->get_size(); k++) {
+			data.push_back(poly->vertices[k].x);
+			data.push_back(poly->vertices[k].y);
+		}
+	}
+
+	l->num_order = (int32_t) layer->path->order.size();
+	data.insert(data.end(), layer->path->order.begin(), layer->path->order.end());
+	l->test_point[0] = layer->test_point.x;
+	l->test_point[1] = layer->test_point.y;
+
+	if (!data.empty() && fwrite(&data[0], 4, data.size(), out) != data.size()) out_ok = false;
+	out_offset += 4 * (uint64_t) data.size();
+
+}
+
+bool SliceCache::end_write() {
+
+	if (!is_writing()) return false;
+
+	if (fseek(out, sizeof(cache_header), SEEK_SET) != 0) out_ok = false;
+	if (out_ok && !out_layers.empty() && fwrite(&out_layers[0], sizeof(cache_layer), out_layers.size(), out) != out_layers.size())
+		out_ok = false;
+	if (fclose(out) != 0) out_ok = false;
+	out = NULL;
+	vector<char>().swap(out_buffer);
+	vector<cache_layer>().swap(out_layers);
+
+	if (out_ok && rename(out_path.c_str(), get_path().c_str()) == 0) return true;
+	remove(out_path.c_str());
+	return false;
+
+}
+
+void SliceCache::close() {
+	if (file_map) munmap((void *) file_map, file_size);
+	file_map = NULL;
+	file_size = 0;
+	header = NULL;
+	layers = NULL;
+}
+
+SliceCache::~SliceCache() {
+	close();
+	if (out) {
+		fclose(out);
+		remove(out_path.c_str());
+	}
+}
@@ -0,0 +1,70 @@
+#ifndef SLICECACHE_H
+#define SLICECACHE_H
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include "polygons.hpp"
+
+#define CACHE_SEED 14695981039346656037ULL
+
+struct cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	int32_t num_planes;
+	int32_t mat_dim;
+	float slice_thickness;
+	int32_t pad;
+};
+
+struct cache_layer {
+	uint64_t offset;
+	int32_t num_contours;
+	int32_t num_contour_points;
+	int32_t num_polys;
+	int32_t num_poly_vertices;
+	int32_t num_order;
+	int32_t test_point[2];
+	int32_t pad;
+};
+
+class SliceCache {
+	public:
+		SliceCache(std::string _dir);
+		static uint64_t hash(const void *data, size_t size, uint64_t seed = CACHE_SEED);
+		static int hash_file(std::string filename, uint64_t *out);
+		bool open(uint64_t _key);
+		bool is_open();
+		int get_num_planes();
+		int get_mat_dim();
+		float get_slice_thickness();
+		Polygons* load_layer(int plane_index, std::vector<std::vector<cv::Point> > *contours);
+		bool begin_write(int num_planes, int mat_dim, float slice_thickness);
+		bool is_writing();
+		void write_layer(int plane_index, Polygons *layer, const std::vector<std::vector<cv::Point> > *contours);
+		bool end_write();
+		~SliceCache();
+	private:
+		std::string get_path();
+		bool check_layers();
+		bool check_layer(const cache_layer *l);
+		void close();
+		std::string dir;
+		uint64_t key;
+		const char *file_map;
+		size_t file_size;
+		const cache_header *header;
+		const cache_layer *layers;
+		FILE *out;
+		std::string out_path;
+		std::vector<cache_layer> out_layers;
+		std::vector<char> out_buffer;
+		uint64_t out_offset;
+		bool out_ok;
+};
+
+#endif
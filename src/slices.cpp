@@ -1,23 +1,56 @@
 #include <math.h>
 #include <assert.h>
 #include <limits>
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+#include <stdint.h>
 #include <opencv2/highgui/highgui.hpp>
 
 #include "slices.hpp"
 #include "vertex.hpp"
+#include "chainer.hpp"
+#include "intersect.hpp"
+#include "parallel.hpp"
 
 #define EPSILON_FRAC 20
 #define MIN_AREA_FRAC 100
 #define BOUNDARY_EPSILON 2
+#define CHAIN_PRECISION 1024.0f
+#define SWEEP_PLANES_PER_THREAD 4
+#define Z_QUERY_MARGIN 1e-3f
 
 using namespace std;
 
-Slices::Slices() { num_planes = 0; }
+Slices::Slices() { 
+	num_planes = 0;
+	contour_engine = CONTOUR_RASTER;
+	sweep = false;
+	kernel = KERNEL_SCALAR;
+	edge_cache = false;
+	incremental = false;
+	num_threads = 1;
+	intersect_ms = 0;
+	contour_ms = 0;
+	simplify_algorithm = SIMPLIFY_DOUGLAS_PEUCKER;
+	budget.max_passes = 0;
+	budget.max_ms = 0;
+	travel_before = travel_after = 0;
+	max_in_flight = 0;
+	first_layer_ms = -1;
+	cache = nullptr;
+	infill_spacing = 0;
+	infill_angle = 0;
+	infill_alternate = false;
+	shell_count = 0;
+	shell_width = 0;
+}
 
 /**
 *
 *	Slices the triangle mesh stored in a mesh object. Determines intersections between each z-slice
-*	and the mesh, draws them to an openCV Mat, and then uses openCV findContours to extract contours.
+*	and the mesh, draws them to an openCV Mat, and then uses openCV findContours to extract contours
+*	(or, with the CONTOUR_CHAIN engine, links the intersection segments into contours directly).
 *	Then, prunes invalid contours, generates polygons from the valid contours, and finally attempts to
 *	generate a short path that visits all polygons. 
 *
@@ -28,67 +61,540 @@ void Slices::make_slices(Mesh *_mesh, float _slice_thickness, const int _mat_dim
 	slice_thickness = _slice_thickness;
 	mat_dim = _mat_dim;
 	min_area = _min_area;
-	int num_facets = my_mesh->get_numFacets();
 
-	init_planes();
-	init_images();
+	float height = my_mesh->mesh_bounds[2][1] - my_mesh->mesh_bounds[2][0];
+	assert(height > 0);
+	init_planes(((int) (height / slice_thickness)) + 2);
+	if (cache && !cache->is_open()) cache->begin_write(num_planes, mat_dim, slice_thickness);
 	
-	// Get intersections between each plane/ slice and the mesh
+	// Get intersections between each plane/ slice and the mesh, and contours for each slice.
+	// Streaming always sweeps, and builds and emits the layers a batch at a time as they're cut
+	if (sweep || stream_sink) {
+		intersect_sweep(0, num_planes - 1);
+	} else {
+		intersect_facet_major();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		parallel_for_each(num_planes, num_threads, [this](int i, int t) { get_contours(i, t); });
+		contour_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+
+	finish_layers();
+
+}
+
+/*
+*
+*	Out-of-core slicing: the mesh has already been split into z-bands (see Bands::split), and
+*	only one band's facets are loaded at a time. Each band is swept over its own planes only,
+*	so the result is the same as sweeping the whole mesh at once
+*
+*/
+void Slices::make_slices(Bands *bands, const int _mat_dim, const int _min_area) {
+
+	slice_thickness = bands->get_slice_thickness();
+	mat_dim = _mat_dim;
+	min_area = _min_area;
+
+	init_planes(bands->get_num_planes());
+	if (cache && !cache->is_open()) cache->begin_write(num_planes, mat_dim, slice_thickness);
+
+	for (int b = 0; b < bands->get_num_bands(); b++) {
+		Mesh band;
+		int first_plane, last_plane;
+		bands->get_band_planes(b, &first_plane, &last_plane);
+		if (!bands->load_band(b, &band)) continue;
+		my_mesh = &band;
+		intersect_sweep(first_plane, last_plane);
+		my_mesh = nullptr;
+	}
+
+	finish_layers();
+
+}
+
+/*
+*
+*	Sets up random access to single layers (see get_layer) without slicing anything yet. Builds
+*	the mesh's z-index if it doesn't have one
+*
+*/
+void Slices::prepare_layers(Mesh *_mesh, float _slice_thickness, const int _mat_dim, const int _min_area) {
+
+	my_mesh = _mesh;
+	slice_thickness = _slice_thickness;
+	mat_dim = _mat_dim;
+	min_area = _min_area;
+
+	float height = my_mesh->mesh_bounds[2][1] - my_mesh->mesh_bounds[2][0];
+	assert(height > 0);
+	init_planes(((int) (height / slice_thickness)) + 2);
+	my_mesh->build_z_index();
+
+}
+
+/*
+*
+*	Slices a single plane on demand, after prepare_layers (or make_slices), and keeps the
+*	result: the facets reaching the plane are looked up in the mesh's z-index rather than
+*	found by a pass over the mesh, and cut in mesh order as the facet-major path would. A layer
+*	sliced this way is entered from the origin, since the layers below it may not exist. After
+*	load_cache, layers are read from the cache instead
+*
+*/
+Polygons* Slices::get_layer(int plane_index) {
+
+	assert(plane_index >= 0 && plane_index < num_planes);
+	int j = plane_index;
+	if (slice_polygons[j]) return slice_polygons[j];
+
+	if (cache && cache->is_open()) {
+		slice_polygons[j] = cache->load_layer(j, &contours[j]);
+		fill_layer(j, 0);
+		return slice_polygons[j];
+	}
+
+	// Widened a little, so facets the plane rule below admits aren't lost to rounding
+	float z = slice_thickness * (float) j;
+	float margin = slice_thickness * Z_QUERY_MARGIN;
+	vector<int> layer_facets;
+	my_mesh->get_facets_at(z - margin, z + margin, &layer_facets);
+	sort(layer_facets.begin(), layer_facets.end());
+
+	for (int k = 0; k < (int) layer_facets.size(); k++) {
+		facet curr;
+		my_mesh->get_facet(layer_facets[k], &curr);
+		float z_min = get_min(curr.a[2], get_min(curr.b[2], curr.c[2]));
+		float z_max = get_max(curr.a[2], get_max(curr.b[2], curr.c[2]));
+		if (ceilf(z_min / slice_thickness) <= j && j <= floorf(z_max / slice_thickness))
+			get_points(&curr, j);
+	}
+
+	get_contours(j, 0);
+	vector<vertex<float> >().swap(slice_points[j]);
+	prune_contours(j);
+
+	vertex<int> origin;
+	origin.x = 0;
+	origin.y = 0;
+	Polygons *p = new Polygons(&contours[j]);
+	p->process_polygons(&origin, simplify_algorithm, &budget);
+	p->set_entry_point(&origin);
+	slice_polygons[j] = p;
+	fill_layer(j, 0);
+	return p;
+
+}
+
+/*
+*
+*	Builds the polygons and paths of any layers that haven't been streamed yet, and re-roots
+*	them in order
+*
+*/
+void Slices::finish_layers() {
+	if (stream_sink) {
+		report_travel();
+		cout << "\nFinished streaming layers....\n";
+	} else {
+		cout << "Making polygons....\n";
+		build_layers(0, num_planes);
+		chain_layers(0, num_planes);
+		report_travel();
+		cout << "\nFinished making polygons....\n";
+	}
+	if (cache && cache->is_writing() && !cache->end_write())
+		cout << "Couldn't write the slice cache\n";
+}
+
+/*
+*
+*	Prunes the contours of planes [first, first + count) (removing duplicate contours, contours
+*	that are too small, etc.), then generates their polygons, paths, shells and infill. Each
+*	slice's path is planned once and independently, so all the planes run in parallel, each
+*	from where the plane below is predicted to end. chain_layers only has to re-root tours at
+*	entry points close to the predicted ones
+*
+*/
+void Slices::build_layers(int first, int count) {
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	parallel_for_each(count, num_threads, [this, first](int i, int) { prune_contours(first + i); });
+	contour_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	vertex<int> origin;
+	origin.x = 0;
+	origin.y = 0;
+
+	// Each plane is planned from where the plane below is predicted to end: the last point of
+	// its last contour (or, like chain_layers, of the last plane below with any contours). This
+	// doesn't depend on how the planes are batched, so streamed layers come out the same as the
+	// rest, and chain_layers re-roots each tour at the real exit using the legs cached here
+	for (int i = first; i < first + count; i++) {
+		if (!contours[i].empty() && !contours[i].back().empty()) {
+			predicted_exits[i].x = contours[i].back().back().x;
+			predicted_exits[i].y = contours[i].back().back().y;
+		} else {
+			predicted_exits[i] = i > 0 ? predicted_exits[i - 1] : origin;
+		}
+	}
+
+	parallel_for_each(count, num_threads, [this, first, &origin](int i, int t) {
+		int j = first + i;
+		Polygons *p = new Polygons(&contours[j]);
+		p->process_polygons(j > 0 ? &predicted_exits[j - 1] : &origin, simplify_algorithm, &budget);
+		slice_polygons[j] = p;
+		fill_layer(j, t);
+	});
+
+}
+
+/*
+*
+*	Re-roots the paths of planes [first, first + count), in order, at the point where the slice
+*	below ends. When streaming, each finished layer is then handed to the sink, the whole batch
+*	to the batch sink if there is one, and everything held for the batch is freed
+*
+*/
+void Slices::chain_layers(int first, int count) {
+
+	for (int i = first; i < first + count; i++) {
+
+		slice_polygons[i]->set_entry_point(&entry);
+		travel_before += slice_polygons[i]->path->travel_before;
+		travel_after += slice_polygons[i]->path->travel_after;
+		slice_polygons[i]->get_exit_point(&entry);
+		if (cache && cache->is_writing()) cache->write_layer(i, slice_polygons[i], &contours[i]);
+
+		if (!stream_sink) continue;
+
+		if (first_layer_ms < 0)
+			first_layer_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start_time).count();
+		stream_sink(i, slice_polygons[i]);
+
+	}
+
+	if (!stream_sink) return;
+
+	if (stream_batch_sink) {
+		vector<Polygons*> batch(slice_polygons.begin() + first, slice_polygons.begin() + first + count);
+		stream_batch_sink(first, &batch);
+	}
+
+	for (int i = first; i < first + count; i++) {
+		delete slice_polygons[i];
+		slice_polygons[i] = nullptr;
+		vector<vector<cv::Point> >().swap(contours[i]);
+		vector<bounds<int> >().swap(contour_bounds[i]);
+		vector<vector<vertex<float> > >().swap(slice_polylines[i]);
+	}
+
+}
+
+/*
+*
+*	Adds a finished layer's shells (see shell_layer), then hatches the region they leave inside
+*	(see Infill), or the whole of its outlines if it has no shells, if infill is enabled.
+*	Alternate layers are hatched at right angles to each other if infill_alternate
+*
+*/
+void Slices::fill_layer(int plane_index, int thread) {
+	shell_layer(plane_index, thread);
+	if (!(infill_spacing > 0)) return;
+	float angle = infill_angle;
+	if (infill_alternate && plane_index % 2) angle += (float) (M_PI / 2.0);
+	Polygons *p = slice_polygons[plane_index];
+	const vector<Polygon*> *region = shell_count > 0 ? &p->infill_bounds : p->get_polygons();
+	infillers[thread].fill(region, infill_spacing, angle, &p->infill);
+}
+
+/*
+*
+*	Insets a finished layer's closed outlines into shell_count shells, shell_width pixels apart,
+*	with the outermost centered half a width inside the outline so that its bead lies within
+*	it (see Offsetter). Also keeps the boundary where the innermost shell's bead ends, which is
+*	what's left for the infill. The offsets are smoothed like the outlines, and the rings of
+*	each shell are ordered greedily (see Polygons::plan_shells)
+*
+*/
+void Slices::shell_layer(int plane_index, int thread) {
+
+	if (shell_count <= 0) return;
+	Polygons *p = slice_polygons[plane_index];
+
+	vector<float> distances(shell_count + 1);
+	for (int k = 0; k < shell_count; k++)
+		distances[k] = ((float) k + 0.5f) * shell_width;
+	distances[shell_count] = (float) shell_count * shell_width;
+
+	vector<vector<vector<cv::Point> > > offsets;
+	offsetters[thread].offset(p->get_polygons(), &distances, &offsets);
+
+	p->shells.assign(shell_count, vector<Polygon*>());
+	for (int k = 0; k < (int) offsets.size(); k++) {
+		vector<Polygon*> *level = k < shell_count ? &p->shells[k] : &p->infill_bounds;
+		for (int j = 0; j < (int) offsets[k].size(); j++) {
+			Polygon *shell = new Polygon(&offsets[k][j]);
+			shell->smooth(simplify_algorithm);
+			// Offsets are rings, but one whose closing edge is long would be taken for an open
+			// polyline and printed without it, so it's closed explicitly
+			if (k < shell_count && shell->is_open()) shell->vertices.push_back(shell->vertices[0]);
+			level->push_back(shell);
+		}
+	}
+
+	p->plan_shells();
+
+}
+
+void Slices::report_travel() {
+	if (budget.max_passes > 0 && travel_before > 0)
+		printf("Tour travel: %.0f before improvement, %.0f after (%.1f%% shorter)\n", travel_before, travel_after, 100 * (1 - travel_after / travel_before));
+	if (stream_sink && first_layer_ms >= 0)
+		printf("First layer emitted after %.0f ms\n", first_layer_ms);
+}
+
+/*
+*
+*	Facet-major intersection: every facet pushes its segments into each plane it crosses, so the
+*	segments of all planes are held in memory at once
+*
+*/
+void Slices::intersect_facet_major() {
+
+	int num_facets = my_mesh->get_numFacets();
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
 	for (int i = 0; i < num_facets; i++) {
 
-		facet *curr = &my_mesh->mesh[i];
-		float z_min = get_min(curr->a[2], get_min(curr->b[2], curr->c[2]));
-		float z_max = get_max(curr->a[2], get_max(curr->b[2], curr->c[2]));
+		facet curr;
+		my_mesh->get_facet(i, &curr);
+		float z_min = get_min(curr.a[2], get_min(curr.b[2], curr.c[2]));
+		float z_max = get_max(curr.a[2], get_max(curr.b[2], curr.c[2]));
 
 		int low_plane = ceilf(z_min / slice_thickness);
 		int high_plane = floorf(z_max / slice_thickness);
 
 		assert(low_plane >= 0 && high_plane >= 0);
-		for (int j = low_plane; j <= high_plane; j++)
-			get_points(i, j);
+		if (incremental) {
+			step_facet(&curr, low_plane, high_plane);
+		} else {
+			for (int j = low_plane; j <= high_plane; j++)
+				get_points(&curr, j);
+		}
 
 	}
-	
-	// Get contours for each slice
-	for (int i = 0; i < num_planes; i++) {
-		
-		int size = (int) slice_points[i].size();
-		
-		for (int j = 0; j < size; j++) {
-			cv::Point start = cv::Point( ((int)slice_points[i][j]->x) + mat_dim/2, ((int)slice_points[i][j]->y) + mat_dim/2);
-			j++;
-			cv::Point end = cv::Point( ((int)slice_points[i][j]->x) + mat_dim/2, ((int)slice_points[i][j]->y) + mat_dim/2);
-			cv::line(slice_images[i], start, end, cv::Scalar(255,0,0), 1);
+
+	intersect_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+}
+
+/*
+*
+*	Plane-major intersection: facets are bucketed by their lowest plane once, and an active
+*	list of facets is advanced plane by plane. Planes are cut a small batch at a time; each
+*	batch's segments are turned into contours (in parallel, one plane per task) and freed before
+*	the next batch is cut, so peak memory tracks the busiest few planes rather than the whole
+*	part. When streaming, each batch also goes on to be polygonized, emitted and freed, and
+*	holds at most max_in_flight planes. With the SIMD kernel, the facets are copied once into structure-of-arrays form in
+*	sorted order and cut in batches. Only planes [first_plane, last_plane] are cut
+*
+*/
+void Slices::intersect_sweep(int first_plane, int last_plane) {
+
+	int num_facets = my_mesh->get_numFacets();
+	vector<int> low_planes(num_facets);
+	vector<int> high_planes(num_facets);
+	vector<int> plane_start(num_planes + 1, 0);
+
+	for (int i = 0; i < num_facets; i++) {
+		facet curr;
+		my_mesh->get_facet(i, &curr);
+		float z_min = get_min(curr.a[2], get_min(curr.b[2], curr.c[2]));
+		float z_max = get_max(curr.a[2], get_max(curr.b[2], curr.c[2]));
+
+		low_planes[i] = ceilf(z_min / slice_thickness);
+		high_planes[i] = floorf(z_max / slice_thickness);
+
+		assert(low_planes[i] >= 0 && high_planes[i] < num_planes);
+		plane_start[low_planes[i] + 1]++;
+	}
+
+	// Counting sort of the facets by lowest plane (i.e. by z_min)
+	for (int j = 0; j < num_planes; j++)
+		plane_start[j + 1] += plane_start[j];
+	vector<int> sorted_facets(num_facets);
+	vector<int> fill(plane_start.begin(), plane_start.end() - 1);
+	for (int i = 0; i < num_facets; i++)
+		sorted_facets[fill[low_planes[i]]++] = i;
+	vector<int>().swap(low_planes);
+
+	// The active list holds positions in sorted order rather than facet ids
+	vector<int> sorted_high(num_facets);
+	for (int k = 0; k < num_facets; k++)
+		sorted_high[k] = high_planes[sorted_facets[k]];
+	vector<int>().swap(high_planes);
+
+	Intersector intersector;
+	bool use_edge_cache = edge_cache && my_mesh->is_indexed();
+	if (use_edge_cache) {
+		my_mesh->build_edges();
+		edge_crossing none;
+		none.plane = -1;
+		edge_crossings.assign(my_mesh->get_numEdges(), none);
+	} else if (kernel == KERNEL_SIMD) {
+		intersector.load(my_mesh, &sorted_facets);
+	}
+
+	// Each slot of a batch lends its segment buffer to the planes that land on it in turn, so
+	// after the first few batches the hot loop no longer allocates
+	int batch_size = SWEEP_PLANES_PER_THREAD * get_num_threads(num_threads);
+	if (stream_sink && max_in_flight > 0) batch_size = max_in_flight;
+	vector<vector<vertex<float> > > plane_buffers(batch_size);
+
+	vector<int> active;
+	for (int j = first_plane; j <= last_plane; j++) {
+
+		// Retire facets that ended below this plane, then admit those that start on it
+		int num_active = 0;
+		for (int k = 0; k < (int) active.size(); k++) {
+			if (sorted_high[active[k]] >= j) active[num_active++] = active[k];
+		}
+		active.resize(num_active);
+		// The first plane of the window also admits the facets that start below it, in the
+		// same order a sweep from plane 0 would have them
+		for (int k = j == first_plane ? 0 : plane_start[j]; k < plane_start[j + 1]; k++) {
+			if (sorted_high[k] >= j) active.push_back(k);
 		}
 
-		cv::Mat img_gray, invert_gray;
-		vector< vector<cv::Point> > curr_contours;
-		
-		cv::cvtColor(slice_images[i], img_gray, CV_BGR2GRAY);
-		cv::bitwise_not(img_gray, invert_gray);
-		cv::findContours(invert_gray, curr_contours, CV_RETR_LIST, CV_CHAIN_APPROX_NONE);
+		int batch_start = j - (j - first_plane) % batch_size;
+		slice_points[j].swap(plane_buffers[j - batch_start]);
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		if (use_edge_cache) {
+			for (int k = 0; k < (int) active.size(); k++)
+				get_points_cached(sorted_facets[active[k]], j);
+		} else if (kernel == KERNEL_SIMD) {
+			if (!active.empty())
+				intersector.intersect(&active[0], (int) active.size(), slice_thickness * (float) j, &slice_points[j]);
+		} else {
+			for (int k = 0; k < (int) active.size(); k++) {
+				facet curr;
+				my_mesh->get_facet(sorted_facets[active[k]], &curr);
+				get_points(&curr, j);
+			}
+		}
+		intersect_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+		if (j < last_plane && j + 1 - batch_start < batch_size) continue;
+
+		start = chrono::steady_clock::now();
+		parallel_for_each(j + 1 - batch_start, num_threads, [this, batch_start](int k, int t) {
+			get_contours(batch_start + k, t);
+		});
+		contour_ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		if (stream_sink) {
+			build_layers(batch_start, j + 1 - batch_start);
+			chain_layers(batch_start, j + 1 - batch_start);
+		}
+		for (int k = batch_start; k <= j; k++) {
+			plane_buffers[k - batch_start].swap(slice_points[k]);
+			plane_buffers[k - batch_start].clear();
+		}
 
-		contours.push_back(curr_contours);
-		
 	}
 
-	// Remove invalid contours (e.g. duplicate contours, contours that are too small, etc.)
-	prune_contours();
+	vector<edge_crossing>().swap(edge_crossings);
 
-	vertex<int> origin;
-	origin.x = 0;
-	origin.y = 0;
-	Polygons::starting_point = &origin;
-
-	// Generate polygons and paths
-	cout << "Making polygons....\n";
-	for (int i = 0; i < num_planes; i++) {		
-		cout << "Generating polys for plane " + to_string(i) + " (" + to_string(100 * (double)i/num_planes) + ")\n";
-		Polygons *p = new Polygons(&contours[i]);
-		p->process_polygons();
-		slice_polygons.push_back(p);
+}
+
+/*
+*
+*	Extracts the contours of one plane into contours[plane_index]. Planes only touch their own
+*	slots (and the raster buffer of the worker running them), so any number of them can be
+*	processed at once
+*
+*/
+void Slices::get_contours(int plane_index, int thread) {
+	if (contour_engine == CONTOUR_CHAIN) chain_contours(plane_index, &contours[plane_index]);
+	else raster_contours(plane_index, &raster_buffers[thread], &contours[plane_index]);
+}
+
+/*
+*
+*	Draws the intersection segments of a slice and recovers the contours with openCV
+*	findContours. Only the part of the mat_dim x mat_dim image covered by the slice's segments
+*	(plus a one pixel border, so findContours sees the same background around them) is drawn,
+*	into a single channel buffer owned by the calling worker. The buffer only grows, so after
+*	the first few planes no allocation is made, and memory is bounded by the largest slice's
+*	bounding box rather than by mat_dim squared times the number of planes
+*
+*/
+void Slices::raster_contours(int plane_index, cv::Mat *buffer, vector<vector<cv::Point> > *out) {
+
+	int i = plane_index;
+	int size = (int) slice_points[i].size();
+	out->clear();
+	if (size == 0) return;
+
+	int x0 = numeric_limits<int>::max(), x1 = numeric_limits<int>::lowest();
+	int y0 = numeric_limits<int>::max(), y1 = numeric_limits<int>::lowest();
+	for (int j = 0; j < size; j++) {
+		int x = ((int)slice_points[i][j].x) + mat_dim/2;
+		int y = ((int)slice_points[i][j].y) + mat_dim/2;
+		if (x < x0) x0 = x;
+		if (x > x1) x1 = x;
+		if (y < y0) y0 = y;
+		if (y > y1) y1 = y;
+	}
+
+	// Crop to the segments' bounds, clipped to the image as cv::line would clip them
+	x0 = max(x0 - 1, 0);
+	y0 = max(y0 - 1, 0);
+	x1 = min(x1 + 1, mat_dim - 1);
+	y1 = min(y1 + 1, mat_dim - 1);
+	if (x0 > x1 || y0 > y1) return;
+	int width = x1 - x0 + 1;
+	int height = y1 - y0 + 1;
+
+	if (buffer->rows < height || buffer->cols < width)
+		*buffer = cv::Mat(max(buffer->rows, height), max(buffer->cols, width), CV_8UC1);
+	cv::Mat crop = (*buffer)(cv::Rect(0, 0, width, height));
+	crop.setTo(cv::Scalar(0));
+
+	for (int j = 0; j < size; j++) {
+		cv::Point start = cv::Point( ((int)slice_points[i][j].x) + mat_dim/2 - x0, ((int)slice_points[i][j].y) + mat_dim/2 - y0);
+		j++;
+		cv::Point end = cv::Point( ((int)slice_points[i][j].x) + mat_dim/2 - x0, ((int)slice_points[i][j].y) + mat_dim/2 - y0);
+		cv::line(crop, start, end, cv::Scalar(255), 1);
+	}
+
+	cv::findContours(crop, *out, CV_RETR_LIST, CV_CHAIN_APPROX_NONE, cv::Point(x0, y0));
+
+}
+
+/*
+*
+*	Links the intersection segments of a slice end to end into polylines, keeping their float
+*	coordinates in slice_polylines. The contours handed to the rest of the pipeline are the same
+*	polylines rounded into image coordinates
+*
+*/
+void Slices::chain_contours(int plane_index, vector<vector<cv::Point> > *out) {
+
+	Chainer chainer(CHAIN_PRECISION);
+	chainer.link(&slice_points[plane_index], &slice_polylines[plane_index]);
+
+	vector<vector<vertex<float> > > *polylines = &slice_polylines[plane_index];
+	int num_polylines = (int) polylines->size();
+	for (int j = 0; j < num_polylines; j++) {
+		vector<cv::Point> contour;
+		int num_points = (int) (*polylines)[j].size();
+		for (int k = 0; k < num_points; k++) {
+			cv::Point p = cv::Point( ((int) lroundf((*polylines)[j][k].x)) + mat_dim/2, ((int) lroundf((*polylines)[j][k].y)) + mat_dim/2);
+			if (contour.empty() || p.x != contour.back().x || p.y != contour.back().y) contour.push_back(p);
+		}
+		out->push_back(contour);
 	}
-	cout << "\nFinished making polygons....\n";
 
 }
 
@@ -97,10 +603,9 @@ void Slices::make_slices(Mesh *_mesh, float _slice_thickness, const int _mat_dim
 *	Get points of facet that intersect the plane with index plane_index
 *
 */
-void Slices::get_points(int facet_index, int plane_index) {
+void Slices::get_points(facet *curr_facet, int plane_index) {
 
 	float z = slice_thickness * (float) plane_index;
-	facet *curr_facet = &my_mesh->mesh[facet_index];
 	
 	float a_dist = curr_facet->a[2] - z;
 	float b_dist = curr_facet->b[2] - z;
@@ -114,20 +619,20 @@ void Slices::get_points(int facet_index, int plane_index) {
 	if (count == 1) return; 
 	if (count == 3) return; // add functionality to deal with case where triangle lies entirely in plane
 
-	vertex<float> *start = new vertex<float>();
-	vertex<float> *end = new vertex<float>();
+	vertex<float> start = vertex<float>();
+	vertex<float> end = vertex<float>();
 
 	if (count == 2) {
 			
 		if (!a_dist && !b_dist) {
-			memcpy((void *)start, (void*) curr_facet->a, (size_t) 8);
-			memcpy((void *)end, (void*) curr_facet->b, (size_t) 8);
+			memcpy((void *)&start, (void*) curr_facet->a, (size_t) 8);
+			memcpy((void *)&end, (void*) curr_facet->b, (size_t) 8);
 		} else if (!b_dist && !c_dist) {
-			memcpy((void *)start, (void*) curr_facet->b, (size_t) 8);
-			memcpy((void *)end, (void*) curr_facet->c, (size_t) 8);
+			memcpy((void *)&start, (void*) curr_facet->b, (size_t) 8);
+			memcpy((void *)&end, (void*) curr_facet->c, (size_t) 8);
 		} else if (!a_dist && !c_dist) {
-			memcpy((void *)start, (void*) curr_facet->a, (size_t) 8);
-			memcpy((void *)end, (void*) curr_facet->c, (size_t) 8);
+			memcpy((void *)&start, (void*) curr_facet->a, (size_t) 8);
+			memcpy((void *)&end, (void*) curr_facet->c, (size_t) 8);
 		}
 
 	} else {
@@ -139,18 +644,18 @@ void Slices::get_points(int facet_index, int plane_index) {
 		if (c_dist < 0) c_below = true;
 
 		if(a_below ^ b_below) {
-			get_intersect(curr_facet->a, curr_facet->b, &start->x, z);
+			get_intersect(curr_facet->a, curr_facet->b, &start.x, z);
 			first_pt = false;
 		}
 
 		if (b_below ^ c_below) {
-			if (first_pt) get_intersect(curr_facet->b, curr_facet->c, &start->x, z);
-			else get_intersect(curr_facet->b, curr_facet->c, &end->x, z);
+			if (first_pt) get_intersect(curr_facet->b, curr_facet->c, &start.x, z);
+			else get_intersect(curr_facet->b, curr_facet->c, &end.x, z);
 		}
 
 		if (a_below ^ c_below) {
 			float s = a_dist / (a_dist - c_dist);
-			get_intersect(curr_facet->a, curr_facet->c, &end->x, z);
+			get_intersect(curr_facet->a, curr_facet->c, &end.x, z);
 		}
 
 	}
@@ -160,6 +665,186 @@ void Slices::get_points(int facet_index, int plane_index) {
 		
 }
 
+/*
+*
+*	Same as get_points, but reads the facet straight from the indexed mesh and looks each edge
+*	crossing up in the edge cache, so the two facets sharing an edge compute its crossing once
+*	and end up with bit-identical endpoints
+*
+*/
+void Slices::get_points_cached(int facet_index, int plane_index) {
+
+	float z = slice_thickness * (float) plane_index;
+	const int *corners = &my_mesh->indices[3 * facet_index];
+	const int *edges = &my_mesh->facet_edges[3 * facet_index];
+	float *a = &my_mesh->vertices[3 * corners[0]];
+	float *b = &my_mesh->vertices[3 * corners[1]];
+	float *c = &my_mesh->vertices[3 * corners[2]];
+
+	float a_dist = a[2] - z;
+	float b_dist = b[2] - z;
+	float c_dist = c[2] - z;
+
+	int count = 0;
+	if (!a_dist) count++;
+	if (!b_dist) count++;
+	if (!c_dist) count++;
+
+	if (count == 1) return;
+	if (count == 3) return;
+
+	vertex<float> start = vertex<float>();
+	vertex<float> end = vertex<float>();
+
+	if (count == 2) {
+
+		if (!a_dist && !b_dist) {
+			memcpy((void *)&start, (void*) a, (size_t) 8);
+			memcpy((void *)&end, (void*) b, (size_t) 8);
+		} else if (!b_dist && !c_dist) {
+			memcpy((void *)&start, (void*) b, (size_t) 8);
+			memcpy((void *)&end, (void*) c, (size_t) 8);
+		} else if (!a_dist && !c_dist) {
+			memcpy((void *)&start, (void*) a, (size_t) 8);
+			memcpy((void *)&end, (void*) c, (size_t) 8);
+		}
+
+	} else {
+
+		bool first_pt = true;
+		bool a_below = a_dist < 0, b_below = b_dist < 0, c_below = c_dist < 0;
+
+		if (a_below ^ b_below) {
+			get_edge_point(edges[0], plane_index, &start);
+			first_pt = false;
+		}
+
+		if (b_below ^ c_below) {
+			if (first_pt) get_edge_point(edges[1], plane_index, &start);
+			else get_edge_point(edges[1], plane_index, &end);
+		}
+
+		if (a_below ^ c_below)
+			get_edge_point(edges[2], plane_index, &end);
+
+	}
+
+	slice_points[plane_index].push_back(start);
+	slice_points[plane_index].push_back(end);
+
+}
+
+/*
+*
+*	Position of an edge's crossing with the current plane, advanced one plane at a time. The
+*	state is always set up at the first plane above the edge's lower endpoint, so two facets
+*	sharing an edge step it through exactly the same values
+*
+*/
+struct edge_step {
+	double x, y, dx, dy;
+	int plane;
+};
+
+static void init_step(edge_step *e, float *p, float *q, float thickness) {
+	double slope_x = ((double) q[0] - p[0]) / ((double) q[2] - p[2]);
+	double slope_y = ((double) q[1] - p[1]) / ((double) q[2] - p[2]);
+	e->plane = (int) ceilf(p[2] / thickness);
+	double rise = (double) (thickness * (float) e->plane) - p[2];
+	e->x = p[0] + rise * slope_x;
+	e->y = p[1] + rise * slope_y;
+	e->dx = slope_x * thickness;
+	e->dy = slope_y * thickness;
+}
+
+static void step_to(edge_step *e, int plane, vertex<float> *out) {
+	while (e->plane < plane) {
+		e->x += e->dx;
+		e->y += e->dy;
+		e->plane++;
+	}
+	out->x = (float) e->x;
+	out->y = (float) e->y;
+}
+
+/*
+*
+*	Facet-major intersection for a facet spanning many planes. The facet's vertices are sorted
+*	by z; every plane between the lowest and highest vertex cuts the long edge and one of the two
+*	short edges, and each edge's crossing is stepped from plane to plane instead of being
+*	reinterpolated. Planes that pass exactly through a vertex fall back to get_points. Segments
+*	keep get_points' orientation (from the a-b edge to b-c, then a-c)
+*
+*/
+void Slices::step_facet(facet *curr_facet, int low_plane, int high_plane) {
+
+	float *v[3] = { curr_facet->a, curr_facet->b, curr_facet->c };
+	int lo = 0, mid = 1, hi = 2;
+	if (v[mid][2] < v[lo][2]) swap(lo, mid);
+	if (v[hi][2] < v[mid][2]) swap(mid, hi);
+	if (v[mid][2] < v[lo][2]) swap(lo, mid);
+
+	// Edge labels follow get_points: 0 is a-b, 1 is b-c and 2 is a-c
+	const int edge_label[3][3] = { { -1, 0, 2 }, { 0, -1, 1 }, { 2, 1, -1 } };
+	int long_label = edge_label[lo][hi];
+	int lower_label = edge_label[lo][mid];
+	int upper_label = edge_label[mid][hi];
+
+	edge_step long_edge, lower_edge, upper_edge;
+	init_step(&long_edge, v[lo], v[hi], slice_thickness);
+	if (v[mid][2] > v[lo][2]) init_step(&lower_edge, v[lo], v[mid], slice_thickness);
+	if (v[hi][2] > v[mid][2]) init_step(&upper_edge, v[mid], v[hi], slice_thickness);
+
+	for (int j = low_plane; j <= high_plane; j++) {
+
+		float z = slice_thickness * (float) j;
+		if (z == v[lo][2] || z == v[mid][2] || z == v[hi][2]) {
+			get_points(curr_facet, j);
+			continue;
+		}
+
+		vertex<float> long_pt;
+		vertex<float> short_pt;
+		int short_label;
+
+		step_to(&long_edge, j, &long_pt);
+		if (z < v[mid][2]) {
+			step_to(&lower_edge, j, &short_pt);
+			short_label = lower_label;
+		} else {
+			step_to(&upper_edge, j, &short_pt);
+			short_label = upper_label;
+		}
+
+		if (short_label < long_label) {
+			slice_points[j].push_back(short_pt);
+			slice_points[j].push_back(long_pt);
+		} else {
+			slice_points[j].push_back(long_pt);
+			slice_points[j].push_back(short_pt);
+		}
+
+	}
+
+}
+
+/*
+*
+*	Returns where an edge crosses the plane, computing it (always from the edge's lower vertex
+*	index to its higher one) only the first time the edge is seen on this plane
+*
+*/
+void Slices::get_edge_point(int edge_index, int plane_index, vertex<float> *out) {
+	edge_crossing *e = &edge_crossings[edge_index];
+	if (e->plane != plane_index) {
+		float *u = &my_mesh->vertices[3 * my_mesh->edge_vertices[2 * edge_index]];
+		float *v = &my_mesh->vertices[3 * my_mesh->edge_vertices[2 * edge_index + 1]];
+		get_intersect(u, v, &e->point.x, slice_thickness * (float) plane_index);
+		e->plane = plane_index;
+	}
+	*out = e->point;
+}
+
 void Slices::get_intersect(float *a, float *b, float *out, float z) {
 		
 	float ret[3];
@@ -179,28 +864,173 @@ void Slices::get_intersect(float *a, float *b, float *out, float z) {
 
 }
 
-void Slices::init_planes() {
-	float height = my_mesh->mesh_bounds[2][1] - my_mesh->mesh_bounds[2][0];
+void Slices::init_planes(int _num_planes) {
+	for (int i = 0; i < (int) slice_polygons.size(); i++)
+		delete slice_polygons[i];
+	slice_points.clear();
+	contours.clear();
+	contour_bounds.clear();
+	slice_polylines.clear();
 
-	assert(height > 0);
-	num_planes = ((int) (height / slice_thickness)) + 2;
+	num_planes = _num_planes;
 	
 	for (int i = 0; i < num_planes; i++) {
-		vector<vertex<float>*> curr_plane;
-		vector<bounds<int>* > curr_bounds;
+		vector<vertex<float> > curr_plane;
+		vector<bounds<int> > curr_bounds;
+		vector<vector<vertex<float> > > curr_polylines;
+		vector<vector<cv::Point> > curr_contours;
 		slice_points.push_back(curr_plane);
+		contours.push_back(curr_contours);
 		contour_bounds.push_back(curr_bounds);
+		slice_polylines.push_back(curr_polylines);
 	}	
 
-}
+	raster_buffers.assign(get_num_threads(num_threads), cv::Mat());
+	infillers.assign(get_num_threads(num_threads), Infill());
+	offsetters.assign(get_num_threads(num_threads), Offsetter());
+	slice_polygons.assign(num_planes, nullptr);
+	predicted_exits.assign(num_planes, vertex<int>());
+	entry.x = 0;
+	entry.y = 0;
+	start_time = chrono::steady_clock::now();
+	first_layer_ms = -1;
+	if (stream_sink) cout << "Streaming layers....\n";
 
-void Slices::init_images() {
-	for (int i = 0; i < num_planes; i++) 
-		slice_images.push_back(cv::Mat(mat_dim, mat_dim, CV_8UC3, cv::Scalar(255, 255, 255)));
 }
 
 int Slices::get_num_planes() { return num_planes; }
 
+void Slices::set_contour_engine(int engine) { contour_engine = engine; }
+
+void Slices::set_sweep(bool _sweep) { sweep = _sweep; }
+
+/*
+*
+*	Selects the intersection kernel used by the sweep. KERNEL_SIMD cuts batches of facets with
+*	the vectorized Intersector; the facet-major path always uses get_points
+*
+*/
+void Slices::set_kernel(int _kernel) { kernel = _kernel; }
+
+/*
+*
+*	Enables the per-edge intersection cache in the sweep. It needs an indexed mesh (see
+*	Mesh::weld) and takes precedence over the choice of kernel
+*
+*/
+void Slices::set_edge_cache(bool _edge_cache) { edge_cache = _edge_cache; }
+
+/*
+*
+*	Makes the facet-major path step each facet's edges from plane to plane (see step_facet)
+*	rather than recomputing every plane's intersection from scratch
+*
+*/
+void Slices::set_incremental(bool _incremental) { incremental = _incremental; }
+
+/*
+*
+*	Sets how many threads extract and prune the contours, and plan the paths, of different
+*	planes concurrently (0 uses every core). The output doesn't depend on the thread count
+*
+*/
+void Slices::set_num_threads(int _num_threads) { num_threads = _num_threads; }
+
+/*
+*
+*	Hatches the inside of every layer with lines spacing pixels apart at angle radians (see
+*	Infill), turned by a right angle on every other layer if alternate. A spacing of 0 (the
+*	default) leaves layers unfilled. Infill isn't cached; it's recomputed when a cached layer is
+*	loaded
+*
+*/
+void Slices::set_infill(float spacing, float angle, bool alternate) {
+	infill_spacing = spacing;
+	infill_angle = angle;
+	infill_alternate = alternate;
+}
+
+/*
+*
+*	Surrounds the inside of every layer with count perimeter shells, width pixels apart (see
+*	shell_layer); the infill, if any, then fills only what's left inside them. A count of 0 (the
+*	default) prints the outlines themselves. Like infill, shells aren't cached
+*
+*/
+void Slices::set_shells(int count, float width) {
+	shell_count = count;
+	shell_width = width;
+}
+
+/*
+*
+*	Enables the 2-opt / Or-opt improvement of each slice's tour: at most max_passes passes over
+*	its polygons, cut short after max_ms milliseconds per slice if max_ms > 0. Only a pass
+*	budget gives the same tours on every run
+*
+*/
+void Slices::set_tour_budget(int max_passes, double max_ms) {
+	budget.max_passes = max_passes;
+	budget.max_ms = max_ms;
+}
+
+/*
+*
+*	Selects how polygons are smoothed: SIMPLIFY_DOUGLAS_PEUCKER (the default) or
+*	SIMPLIFY_VISVALINGAM
+*
+*/
+void Slices::set_simplifier(int algorithm) { simplify_algorithm = algorithm; }
+
+/*
+*
+*	Streams the layers instead of keeping them all: planes are swept a batch of at most
+*	max_in_flight at a time (0 picks a few per thread), and each finished layer is passed to
+*	sink, in plane order. If there's a batch sink, each finished batch is then passed to it
+*	whole (e.g. to work on its layers in parallel). A batch's layers are freed once the sinks
+*	return, so slice_polygons only holds the layers in flight. Streaming always uses the sweep
+*
+*/
+void Slices::set_streaming(int _max_in_flight, layer_sink sink, batch_sink batch) {
+	max_in_flight = _max_in_flight;
+	stream_sink = sink;
+	stream_batch_sink = batch;
+}
+
+/*
+*
+*	Makes make_slices write every finished layer to _cache, under the key last given to
+*	SliceCache::open
+*
+*/
+void Slices::set_cache(SliceCache *_cache) { cache = _cache; }
+
+/*
+*
+*	Takes the slices from a cache that SliceCache::open found, instead of slicing anything.
+*	Layers are only restored as they're asked for (see get_layer)
+*
+*/
+void Slices::load_cache(SliceCache *_cache) {
+	cache = _cache;
+	assert(cache->is_open());
+	slice_thickness = cache->get_slice_thickness();
+	mat_dim = cache->get_mat_dim();
+	my_mesh = nullptr;
+	init_planes(cache->get_num_planes());
+}
+
+/*
+*
+*	Folds every setting that can change the slices into a cache key (see SliceCache::hash)
+*
+*/
+uint64_t Slices::get_settings_hash(uint64_t seed) {
+	int settings[8] = { contour_engine, sweep || stream_sink, kernel, edge_cache, incremental, simplify_algorithm, budget.max_passes, 0 };
+	uint64_t h = SliceCache::hash(settings, sizeof(settings), seed);
+	return SliceCache::hash(&budget.max_ms, sizeof(budget.max_ms), h);
+}
+
 void Slices::scale_vec(float *v, float s) {
 	v[0] *= s;
 	v[1] *= s;
@@ -223,74 +1053,121 @@ float Slices::get_min(float x, float y) {
 	else return y;
 }
 
-void Slices::prune_contours() {	
+/*
+*
+*	Removes invalid contours from one plane (e.g. duplicate contours, contours that are too
+*	small, etc.). Only touches that plane's contours and bounds. Each contour's area and bounds
+*	are computed once, and duplicate candidates are found by bucketing contours on the lower
+*	corner of their bounds in BOUNDARY_EPSILON sized cells: contours whose bounds all match
+*	within BOUNDARY_EPSILON land in the same or a neighbouring cell. Removals are marked and
+*	the survivors compacted in one pass at the end
+*
+*/
+void Slices::prune_contours(int plane_index) {
+
+	int i = plane_index;
 	
-	for (int i = 0; i < num_planes; i++) {
-		
-		int num_contours = (int) contours[i].size();
-		
-		for (int j = 0; j < num_contours; j++) {
-			bounds<int> *b = new bounds<int>();
-			b->x[0] = numeric_limits<int>::max();
-			b->x[1] = numeric_limits<int>::lowest();
-			b->y[0] = numeric_limits<int>::max();
-			b->y[1] = numeric_limits<int>::lowest();
-
-			int num_points = (int) contours[i][j].size();
-			for (int k = 1; k < num_points - 1; k++) {
-				int x = contours[i][j][k].x;
-				int y = contours[i][j][k].y;
-				if (x < b->x[0]) b->x[0] = x;
-				if (x > b->x[1]) b->x[1] = x;
-				if (y < b->y[0]) b->y[0] = y;
-				if (y > b->y[1]) b->y[1] = y;
-			}
+	int num_contours = (int) contours[i].size();
+	vector<bounds<int> > *plane_bounds = &contour_bounds[i];
+	plane_bounds->resize(num_contours);
+	vector<double> areas(num_contours);
+	
+	for (int j = 0; j < num_contours; j++) {
+		bounds<int> *b = &(*plane_bounds)[j];
+		b->x[0] = numeric_limits<int>::max();
+		b->x[1] = numeric_limits<int>::lowest();
+		b->y[0] = numeric_limits<int>::max();
+		b->y[1] = numeric_limits<int>::lowest();
 
-			contour_bounds[i].push_back(b);	
+		int num_points = (int) contours[i][j].size();
+		for (int k = 1; k < num_points - 1; k++) {
+			int x = contours[i][j][k].x;
+			int y = contours[i][j][k].y;
+			if (x < b->x[0]) b->x[0] = x;
+			if (x > b->x[1]) b->x[1] = x;
+			if (y < b->y[0]) b->y[0] = y;
+			if (y > b->y[1]) b->y[1] = y;
 		}
 
-		for (int j = 0; j < (int) contours[i].size() - 1; j++) {
-			
-			double currArea = abs(contourArea(contours[i][j], false));
-
-			if (currArea < (mat_dim/MIN_AREA_FRAC)) {
-			 	contours[i].erase(contours[i].begin() + j);
-			 	contour_bounds[i].erase(contour_bounds[i].begin() + j);
-			 	j--;
-			} else {
-				for (int k = j + 1; k < (int) contours[i].size(); k++) {
-				
-					if (abs(contour_bounds[i][j]->x[1] - contour_bounds[i][k]->x[1]) < BOUNDARY_EPSILON &&
-						abs(contour_bounds[i][j]->x[0] - contour_bounds[i][k]->x[0]) < BOUNDARY_EPSILON &&
-						abs(contour_bounds[i][j]->y[1] - contour_bounds[i][k]->y[1]) < BOUNDARY_EPSILON &&
-						abs(contour_bounds[i][j]->y[0] - contour_bounds[i][k]->y[0]) < BOUNDARY_EPSILON
+		areas[j] = contourArea(contours[i][j], false);
+	}
+
+	// Each bucket is a linked list of contour indices, in increasing order
+	unordered_map<int64_t, int> bucket_head;
+	vector<int> bucket_next(num_contours);
+	for (int j = num_contours - 1; j >= 0; j--) {
+		int64_t key = get_bucket_key(get_bucket((*plane_bounds)[j].x[0]), get_bucket((*plane_bounds)[j].y[0]));
+		unordered_map<int64_t, int>::iterator head = bucket_head.find(key);
+		bucket_next[j] = head == bucket_head.end() ? -1 : head->second;
+		bucket_head[key] = j;
+	}
+
+	vector<char> removed(num_contours, 0);
+	int last = num_contours - 1;
+	for (int j = 0; j < num_contours; j++) {
+
+		if (removed[j]) continue;
+
+		// The last remaining contour is never checked against itself or for its area
+		while (last >= 0 && removed[last]) last--;
+		if (j >= last) break;
+
+		double currArea = areas[j];
+
+		if (currArea < (mat_dim/MIN_AREA_FRAC)) {
+			removed[j] = 1;
+			continue;
+		}
+
+		bounds<int> *b = &(*plane_bounds)[j];
+		int cx = get_bucket(b->x[0]);
+		int cy = get_bucket(b->y[0]);
+		for (int dx = -1; dx <= 1; dx++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				unordered_map<int64_t, int>::iterator head = bucket_head.find(get_bucket_key(cx + dx, cy + dy));
+				if (head == bucket_head.end()) continue;
+				for (int k = head->second; k >= 0; k = bucket_next[k]) {
+					if (k <= j || removed[k]) continue;
+					bounds<int> *c = &(*plane_bounds)[k];
+					if (abs(b->x[1] - c->x[1]) < BOUNDARY_EPSILON &&
+						abs(b->x[0] - c->x[0]) < BOUNDARY_EPSILON &&
+						abs(b->y[1] - c->y[1]) < BOUNDARY_EPSILON &&
+						abs(b->y[0] - c->y[0]) < BOUNDARY_EPSILON
 					) {
-						if ((currArea - contourArea(contours[i][k], false)) < (mat_dim/EPSILON_FRAC)) {
-							contours[i].erase(contours[i].begin() + k);
-							contour_bounds[i].erase(contour_bounds[i].begin() + k);
-							k--;
-						}
+						if ((currArea - areas[k]) < (mat_dim/EPSILON_FRAC)) removed[k] = 1;
 					}
-
 				}
 			}
-
 		}
-		
 
 	}
 
+	int kept = 0;
+	for (int j = 0; j < num_contours; j++) {
+		if (removed[j]) continue;
+		if (kept != j) {
+			contours[i][kept].swap(contours[i][j]);
+			(*plane_bounds)[kept] = (*plane_bounds)[j];
+		}
+		kept++;
+	}
+	contours[i].resize(kept);
+	plane_bounds->resize(kept);
+
 }
 
-Slices::~Slices() {
-	for (int i = 0; i < num_planes; i++) {
-		int size = (int) slice_points[i].size();
-		for (int j = 0; j < size; j++) {
-			delete slice_points[i][j];
-		}
-		int num_contours = (int) contour_bounds[i].size();
-		for (int j = 0; j < num_contours; j++) {
-			delete contour_bounds[i][j];
-		}
- 	}
-}
\ No newline at end of file
+/*
+*
+*	Bucket of a bound coordinate for duplicate detection (rounds down for negative coordinates)
+*
+*/
+int Slices::get_bucket(int x) {
+	if (x >= 0) return x / BOUNDARY_EPSILON;
+	return -((-x + BOUNDARY_EPSILON - 1) / BOUNDARY_EPSILON);
+}
+
+int64_t Slices::get_bucket_key(int cx, int cy) {
+	return ((int64_t) cx << 32) ^ (int64_t) (uint32_t) cy;
+}
+
+Slices::~Slices() {}
\ No newline at end of file
@@ -2,37 +2,117 @@
 #define SLICES_H
 
 #include <vector>
+#include <chrono>
+#include <functional>
+#include <stdint.h>
 #include <opencv2/opencv.hpp>
 
 #include "mesh.hpp"
+#include "bands.hpp"
+#include "slicecache.hpp"
 #include "polygons.hpp"
+#include "simplify.hpp"
+#include "infill.hpp"
+#include "offset.hpp"
+
+#define CONTOUR_RASTER 0
+#define CONTOUR_CHAIN 1
+
+typedef std::function<void(int plane_index, Polygons *layer)> layer_sink;
+typedef std::function<void(int first_plane, std::vector<Polygons*> *layers)> batch_sink;
+
+struct edge_crossing {
+	int plane;
+	vertex<float> point;
+};
 
 class Slices {
 	public:
 		Slices();
 		void make_slices(Mesh *_mesh, float _slice_thickness, const int _mat_dim, const int _min_area);
+		void make_slices(Bands *bands, const int _mat_dim, const int _min_area);
+		void prepare_layers(Mesh *_mesh, float _slice_thickness, const int _mat_dim, const int _min_area);
+		Polygons* get_layer(int plane_index);
 		int get_num_planes();
+		void set_contour_engine(int engine);
+		void set_sweep(bool _sweep);
+		void set_kernel(int _kernel);
+		void set_edge_cache(bool _edge_cache);
+		void set_incremental(bool _incremental);
+		void set_num_threads(int _num_threads);
+		void set_tour_budget(int max_passes, double max_ms);
+		void set_simplifier(int algorithm);
+		void set_infill(float spacing, float angle, bool alternate);
+		void set_shells(int count, float width);
+		void set_streaming(int _max_in_flight, layer_sink sink, batch_sink batch = batch_sink());
+		void set_cache(SliceCache *_cache);
+		void load_cache(SliceCache *_cache);
+		uint64_t get_settings_hash(uint64_t seed);
 		~Slices();
 		std::vector<std::vector<std::vector<cv::Point> > > contours;
-		std::vector<std::vector<bounds<int>* > > contour_bounds;
-		std::vector<cv::Mat> slice_images;
+		std::vector<std::vector<std::vector<vertex<float> > > > slice_polylines;
+		std::vector<std::vector<bounds<int> > > contour_bounds;
 		std::vector<Polygons*> slice_polygons;
 		int mat_dim;
 		float slice_thickness;
+		double intersect_ms;
+		double contour_ms;
+		double travel_before;
+		double travel_after;
+		double first_layer_ms;
 	private:
-		void init_planes();
-		void init_images();
-		void get_points(int facet_index, int plane_index);
+		void init_planes(int _num_planes);
+		void intersect_facet_major();
+		void intersect_sweep(int first_plane, int last_plane);
+		void get_points(facet *curr_facet, int plane_index);
+		void get_points_cached(int facet_index, int plane_index);
+		void step_facet(facet *curr_facet, int low_plane, int high_plane);
+		void get_edge_point(int edge_index, int plane_index, vertex<float> *out);
+		void get_contours(int plane_index, int thread);
+		void raster_contours(int plane_index, cv::Mat *buffer, std::vector<std::vector<cv::Point> > *out);
+		void chain_contours(int plane_index, std::vector<std::vector<cv::Point> > *out);
 		void get_intersect(float *a, float *b, float *out, float z);
 		void scale_vec(float *v, float s);
 		void add_vec(float *u, float *v, float *w);
-		void prune_contours();
+		void finish_layers();
+		void build_layers(int first, int count);
+		void chain_layers(int first, int count);
+		void report_travel();
+		void prune_contours(int plane_index);
+		void fill_layer(int plane_index, int thread);
+		void shell_layer(int plane_index, int thread);
+		static int get_bucket(int x);
+		static int64_t get_bucket_key(int cx, int cy);
 		float get_max(float x, float y);
 		float get_min(float x, float y);
-		std::vector<std::vector<vertex<float>*> > slice_points;
+		std::vector<std::vector<vertex<float> > > slice_points;
 		Mesh *my_mesh;
 		int num_planes;
 		int min_area;
+		int contour_engine;
+		bool sweep;
+		int kernel;
+		bool edge_cache;
+		bool incremental;
+		int num_threads;
+		tour_budget budget;
+		int simplify_algorithm;
+		std::vector<edge_crossing> edge_crossings;
+		std::vector<cv::Mat> raster_buffers;
+		std::vector<Infill> infillers;
+		float infill_spacing;
+		float infill_angle;
+		bool infill_alternate;
+		std::vector<Offsetter> offsetters;
+		int shell_count;
+		float shell_width;
+		int max_in_flight;
+		layer_sink stream_sink;
+		batch_sink stream_batch_sink;
+		SliceCache *cache;
+		vertex<int> entry;
+		std::vector<vertex<int> > predicted_exits;
+		std::chrono::steady_clock::time_point start_time;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include <assert.h>
+#include <algorithm>
+#include "zindex.hpp"
+
+using namespace std;
+
+/*
+*
+*	A ZIndex is a centered interval tree over the z-ranges of a mesh's facets, so that the
+*	facets reaching any height can be found in O(log n + k) without a pass over the whole
+*	mesh. Each node holds the intervals that contain its center twice, sorted by z_min and by
+*	z_max, and the intervals entirely below or above its center go to its left or right child.
+*	The nodes are laid out in arrays rather than allocated one by one
+*
+*/
+ZIndex::ZIndex() {
+	built = false;
+}
+
+void ZIndex::build(const vector<float> *_z_min, const vector<float> *_z_max) {
+
+	z_min = *_z_min;
+	z_max = *_z_max;
+	int n = (int) z_min.size();
+	assert((int) z_max.size() == n);
+
+	ids.resize(n);
+	for (int i = 0; i < n; i++)
+		ids[i] = i;
+	by_min.resize(n);
+	by_max.resize(n);
+
+	nodes.clear();
+	if (n) build_node(0, n);
+	vector<int>().swap(ids);
+	built = true;
+
+}
+
+void ZIndex::clear() {
+	vector<float>().swap(z_min);
+	vector<float>().swap(z_max);
+	vector<z_node>().swap(nodes);
+	vector<int>().swap(by_min);
+	vector<int>().swap(by_max);
+	built = false;
+}
+
+bool ZIndex::is_built() { return built; }
+
+/*
+*
+*	Builds the node for ids[first, first + count) around the median interval midpoint, which
+*	leaves at most half of the intervals to either child, and returns the node's index. The
+*	range is partitioned in place into the intervals below, containing and above the center
+*
+*/
+int ZIndex::build_node(int first, int count) {
+
+	vector<int>::iterator begin = ids.begin() + first;
+	vector<int>::iterator end = begin + count;
+	nth_element(begin, begin + count / 2, end, [this](int a, int b) {
+		return z_min[a] + z_max[a] < z_min[b] + z_max[b];
+	});
+	int median = *(begin + count / 2);
+	float center = (z_min[median] + z_max[median]) / 2.0f;
+
+	vector<int>::iterator mid_begin = partition(begin, end, [this, center](int i) { return z_max[i] < center; });
+	vector<int>::iterator mid_end = partition(mid_begin, end, [this, center](int i) { return z_min[i] <= center; });
+	int num_left = (int) (mid_begin - begin);
+	int num_mid = (int) (mid_end - mid_begin);
+	int num_right = count - num_left - num_mid;
+
+	int index = (int) nodes.size();
+	nodes.push_back(z_node());
+
+	int mid_first = first + num_left;
+	copy(mid_begin, mid_end, by_min.begin() + mid_first);
+	copy(mid_begin, mid_end, by_max.begin() + mid_first);
+	sort(by_min.begin() + mid_first, by_min.begin() + mid_first + num_mid, [this](int a, int b) {
+		return z_min[a] < z_min[b];
+	});
+	sort(by_max.begin() + mid_first, by_max.begin() + mid_first + num_mid, [this](int a, int b) {
+		return z_max[a] > z_max[b];
+	});
+
+	int left = num_left ? build_node(first, num_left) : -1;
+	int right = num_right ? build_node(mid_first + num_mid, num_right) : -1;
+
+	z_node *node = &nodes[index];
+	node->center = center;
+	node->left = left;
+	node->right = right;
+	node->first = mid_first;
+	node->count = num_mid;
+	return index;
+
+}
+
+/*
+*
+*	Appends to out the index of every facet whose z-range overlaps [z_lo, z_hi], in no
+*	particular order
+*
+*/
+void ZIndex::query(float z_lo, float z_hi, vector<int> *out) {
+
+	assert(built);
+	if (nodes.empty()) return;
+
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top) {
+
+		z_node *node = &nodes[stack[--top]];
+		int end = node->first + node->count;
+
+		if (z_hi < node->center) {
+			for (int k = node->first; k < end && z_min[by_min[k]] <= z_hi; k++)
+				out->push_back(by_min[k]);
+			if (node->left >= 0) stack[top++] = node->left;
+		} else if (z_lo > node->center) {
+			for (int k = node->first; k < end && z_max[by_max[k]] >= z_lo; k++)
+				out->push_back(by_max[k]);
+			if (node->right >= 0) stack[top++] = node->right;
+		} else {
+			for (int k = node->first; k < end; k++)
+				out->push_back(by_min[k]);
+			if (node->left >= 0) stack[top++] = node->left;
+			if (node->right >= 0) stack[top++] = node->right;
+		}
+
+	}
+
+}
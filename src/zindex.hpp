@@ -0,0 +1,32 @@
+#ifndef ZINDEX_H
+#define ZINDEX_H
+
+#include <vector>
+
+struct z_node {
+	float center;
+	int left;
+	int right;
+	int first;
+	int count;
+};
+
+class ZIndex {
+	public:
+		ZIndex();
+		void build(const std::vector<float> *_z_min, const std::vector<float> *_z_max);
+		void query(float z_lo, float z_hi, std::vector<int> *out);
+		void clear();
+		bool is_built();
+	private:
+		int build_node(int first, int count);
+		std::vector<float> z_min;
+		std::vector<float> z_max;
+		std::vector<z_node> nodes;
+		std::vector<int> ids;
+		std::vector<int> by_min;
+		std::vector<int> by_max;
+		bool built;
+};
+
+#endif